@@ -3,6 +3,12 @@
 output_path=$1
 input_string=$2
 
+MERGER_FILE_PATH=/publicfs/cms/user/licq/pheno/anomdet/gen/delphes_ana_el9/mergeNtuples.C
+
 mkdir -p $(dirname "$output_path")
 rm -f $output_path
-hadd $output_path ${input_string//,/ }
+# merge all inputs into output_path, copying the baskets without recompression when possible;
+# the merge manifest stays in a scratch directory of the job instead of next to the output
+work_dir=$(mktemp -d)
+root -b -q $MERGER_FILE_PATH'+("'$input_string'", "'$(dirname $output_path)'", "'$(basename $output_path .root)'", 0, 0, 1, "'$work_dir/merge.json'")'
+rm -rf $work_dir
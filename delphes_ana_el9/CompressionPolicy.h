@@ -0,0 +1,89 @@
+#ifndef CompressionPolicy_h
+#define CompressionPolicy_h
+
+#include "TTree.h"
+#include "TBranch.h"
+#include <map>
+#include <string>
+#include <stdexcept>
+#include "nlohmann/json.hpp"
+
+// Compression and basket layout of an output tree, applied per branch after EventData::setOutputBranch (and before the first Fill).
+// Compression settings are ROOT's algorithm * 100 + level: 101 zlib, 207 lzma, 404 lz4, 505 zstd, ... (-1: the file setting).
+// Presets (policy=...):
+//  - "default": file settings, ROOT basket sizes (vectors 102400 bytes)
+//  - "fast": lz4 for all branches, for the fastest reads (training inputs read many times)
+//  - "balanced": lz4 for the jet scalars read by selections and plots, zstd 5 for the large particle vectors
+//  - "small": zstd 5 for the scalars, zstd 9 for the vectors, for archival
+// Then per-key overrides: scalar, vector (settings of all scalar / vector branches), branch.<name> (settings of one branch),
+// scalar_basket, vector_basket (bytes), autoflush (TTree::SetAutoFlush: > 0 entries, < 0 bytes per cluster, 0: ROOT default).
+// Unknown keys are rejected.
+struct CompressionPolicy {
+    int scalar = -1, vector = -1;
+    std::map<std::string, int> branches;
+    int scalarBasket = 0, vectorBasket = 0;
+    long autoFlush = 0;
+
+    bool empty() const {
+        return scalar < 0 && vector < 0 && branches.empty() && scalarBasket <= 0 && vectorBasket <= 0 && autoFlush == 0;
+    }
+
+    // Set the compression, basket sizes and cluster size of the branches of an output tree
+    void applyTo(TTree* tree) const {
+        if (autoFlush != 0)  tree->SetAutoFlush(autoFlush);
+        TObjArray* list = tree->GetListOfBranches();
+        for (int i = 0; i < list->GetEntriesFast(); ++i) {
+            TBranch* branch = static_cast<TBranch*>(list->At(i));
+            // vectors are branch elements with a class, scalars plain leaves
+            bool isVector = std::string(branch->GetClassName()).size() > 0;
+            auto it = branches.find(branch->GetName());
+            int settings = it != branches.end() ? it->second : (isVector ? vector : scalar);
+            if (settings >= 0)  branch->SetCompressionSettings(settings);
+            int basket = isVector ? vectorBasket : scalarBasket;
+            if (basket > 0)  branch->SetBasketSize(basket);
+        }
+    }
+};
+
+
+CompressionPolicy compressionPolicy(const std::map<std::string, std::string>& options) {
+    CompressionPolicy policy;
+    std::string preset = options.count("policy") ? options.at("policy") : "default";
+    if (preset == "fast") {
+        policy.scalar = 404;
+        policy.vector = 404;
+    }
+    else if (preset == "balanced") {
+        policy.scalar = 404;
+        policy.vector = 505;
+    }
+    else if (preset == "small") {
+        policy.scalar = 505;
+        policy.vector = 509;
+    }
+    else if (preset != "default") {
+        throw std::runtime_error("Unknown compression policy: " + preset);
+    }
+    for (const auto& pair : options) {
+        if (pair.first == "scalar")  policy.scalar = std::stoi(pair.second);
+        else if (pair.first == "vector")  policy.vector = std::stoi(pair.second);
+        else if (pair.first.compare(0, 7, "branch.") == 0)  policy.branches[pair.first.substr(7)] = std::stoi(pair.second);
+        else if (pair.first == "scalar_basket")  policy.scalarBasket = std::stoi(pair.second);
+        else if (pair.first == "vector_basket")  policy.vectorBasket = std::stoi(pair.second);
+        else if (pair.first == "autoflush")  policy.autoFlush = std::stol(pair.second);
+        else if (pair.first != "policy")  throw std::runtime_error("Unknown compression policy option: " + pair.first);
+    }
+    return policy;
+}
+
+
+// Policy of the "output_compression" block of a mix json, e.g. {"policy": "balanced", "autoflush": -50000000, "branch.jet_label": 101}
+CompressionPolicy readCompressionPolicy(const nlohmann::json& j) {
+    std::map<std::string, std::string> options;
+    for (const auto& item : j.items()) {
+        options[item.key()] = item.value().is_string() ? item.value().get<std::string>() : item.value().dump();
+    }
+    return compressionPolicy(options);
+}
+
+#endif
@@ -2,11 +2,69 @@
 #define EventData_h
 
 #include "TTree.h"
+#include "TBranch.h"
+#include "TLeaf.h"
+#include <iostream>
+#include <memory>
 #include <vector>
 #include <map>
+#include <set>
+#include <algorithm>
 #include <string>
+#include <cmath>
+#include <cstdio>
+#include <sstream>
 #include <stdexcept>
 
+// Opt-in compact on-disk encoding of output branches, written by EventData::setOutputBranch / encodeCompact and expanded transparently by
+// EventData::setBranchAddresses (the encoding is described by the branch titles, so the readers need no configuration):
+//  - flags: up to 8 vector<bool> branches packed as the bits of one vector<unsigned char> branch, title "compact:flags:<bit0>,<bit1>,..."
+//  - ints: vector<int> branches stored as vector<char> ("int8") or vector<short> ("int16"); out-of-range values are an error
+//  - ranges: vector<float> branches quantized like a Float16_t with a declared range: nbits (<= 16) bits over [min, max] stored as
+//    vector<unsigned short>, title "compact:range:<min>,<max>,<nbits>"; values outside the range are clamped
+struct CompactSchema {
+    struct Range {
+        float min, max;
+        int nbits;
+    };
+    std::map<std::string, std::vector<std::string>> flags;
+    std::map<std::string, std::string> ints;
+    std::map<std::string, Range> ranges;
+
+    bool empty() const {
+        return flags.empty() && ints.empty() && ranges.empty();
+    }
+};
+
+
+// Compact schema of the JetClass-II particle branches present in a branch list: the five particle-type flags packed into part_flags, the
+// charge as int8 and the pid as int16, the angular distances and impact-parameter errors as 16-bit ranges (the errors are clipped to
+// [0, 1] by the Sophon preprocessing anyway)
+CompactSchema jetClassCompactSchema(const std::vector<std::pair<std::string, std::string>>& branchList) {
+    std::map<std::string, std::string> types(branchList.begin(), branchList.end());
+    auto has = [&](const std::string& name, const std::string& type) {
+        return types.count(name) && types.at(name) == type;
+    };
+    CompactSchema schema;
+    std::vector<std::string> flags;
+    for (auto name : {"part_isElectron", "part_isMuon", "part_isPhoton", "part_isChargedHadron", "part_isNeutralHadron"}) {
+        if (has(name, "vector<bool>"))  flags.push_back(name);
+    }
+    if (!flags.empty())  schema.flags["part_flags"] = flags;
+    if (has("part_charge", "vector<int>"))  schema.ints["part_charge"] = "int8";
+    for (auto name : {"part_pid", "genpart_pid", "aux_genpart_pid"}) {
+        if (has(name, "vector<int>"))  schema.ints[name] = "int16";
+    }
+    for (auto name : {"part_deta", "part_dphi"}) {
+        if (has(name, "vector<float>"))  schema.ranges[name] = {-2, 2, 16};
+    }
+    for (auto name : {"part_d0err", "part_dzerr"}) {
+        if (has(name, "vector<float>"))  schema.ranges[name] = {0, 1, 16};
+    }
+    return schema;
+}
+
+
 // Define a struct to hold all branch variables
 struct EventData {
     std::vector<std::pair<std::string, std::string>> branchList;
@@ -81,22 +139,316 @@ struct EventData {
         }
     }
 
-    // Set branch addresses for an input tree
+    // Whether every branch of this EventData is in data with the same type, i.e. it can borrow the vectors of data with swapVectors
+    bool subsetOf(const EventData& data) const {
+        for (const auto& pair : branchList) {
+            if (std::find(data.branchList.begin(), data.branchList.end(), pair) == data.branchList.end())  return false;
+        }
+        return true;
+    }
+
+    // Copy the scalar branches from another EventData
+    void copyScalars(const EventData& data) {
+        for (auto& pair : boolVars)   pair.second = data.boolVars.at(pair.first);
+        for (auto& pair : intVars)    pair.second = data.intVars.at(pair.first);
+        for (auto& pair : uintVars)   pair.second = data.uintVars.at(pair.first);
+        for (auto& pair : floatVars)  pair.second = data.floatVars.at(pair.first);
+    }
+
+    // Exchange the contents of the vector branches with those of data (requires subsetOf(data)). Only the vector buffers are swapped, the
+    // vector objects stay in place, so the branch addresses of the trees bound to both EventData remain valid. Used instead of copy to hand
+    // the input vectors to the output tree for one Fill: swap, Fill, swap back before the next GetEntry of the input.
+    void swapVectors(EventData& data) {
+        swapVectors(vboolVars, data.vboolVars);
+        swapVectors(vintVars, data.vintVars);
+        swapVectors(vfloatVars, data.vfloatVars);
+    }
+
+    template <class T>
+    static void swapVectors(std::map<std::string, std::vector<T>*>& vars, std::map<std::string, std::vector<T>*>& other) {
+        for (auto& pair : vars) {
+            auto& vec = other.at(pair.first);
+            if (!pair.second)  pair.second = new std::vector<T>;
+            if (!vec)  vec = new std::vector<T>;
+            pair.second->swap(*vec);
+        }
+    }
+
+    // Schema adaptation for input trees: alternative on-disk names of the declared branches, and the values of the declared branches
+    // that are missing on disk (0 if not given; missing vector branches are left empty)
+    std::map<std::string, std::vector<std::string>> aliases;
+    std::map<std::string, double> defaults;
+
+    // Staging buffer of a declared branch whose on-disk type differs (or that is missing, diskType == ""), converted after each read
+    struct Staging {
+        std::string name, type, diskType;
+        bool b = 0;
+        int i = 0;
+        uint u = 0;
+        float f = 0;
+        double d = 0;
+        std::vector<bool>* vb = nullptr;
+        std::vector<int>* vi = nullptr;
+        std::vector<float>* vf = nullptr;
+        std::vector<double>* vd = nullptr;
+        // compact encodings: packed flags (diskType "packed", shared by the "flag" stagings of its bits), narrow ints, quantized ranges
+        std::vector<unsigned char>* vuc = nullptr;
+        std::vector<char>* vc = nullptr;
+        std::vector<short>* vs = nullptr;
+        std::vector<unsigned short>* vus = nullptr;
+        const Staging* packed = nullptr;
+        int bit = 0;
+        CompactSchema::Range range = {0, 0, 0};
+        std::vector<bool> bits;
+        std::vector<float> decoded;
+        ~Staging() {
+            delete vb;
+            delete vi;
+            delete vf;
+            delete vd;
+            delete vuc;
+            delete vc;
+            delete vs;
+            delete vus;
+        }
+    };
+    std::map<TTree*, std::vector<std::unique_ptr<Staging>>> staging;
+
+    // Type of a branch on disk, with the names of the branch lists
+    static std::string branchType(TBranch* branch) {
+        std::string className = branch->GetClassName();
+        if (!className.empty())  return className;
+        TLeaf* leaf = static_cast<TLeaf*>(branch->GetListOfLeaves()->At(0));
+        std::string type = leaf ? leaf->GetTypeName() : "";
+        if (type == "Bool_t")  return "bool";
+        if (type == "Int_t")  return "int";
+        if (type == "UInt_t")  return "uint";
+        if (type == "Float_t")  return "float";
+        if (type == "Double_t")  return "double";
+        return type;
+    }
+
+    // Packed flag branches of a tree (CompactSchema): flag name -> (packed branch, bit)
+    static std::map<std::string, std::pair<std::string, int>> packedFlags(TTree* tree) {
+        std::map<std::string, std::pair<std::string, int>> flags;
+        TObjArray* branches = tree->GetListOfBranches();
+        for (int i = 0; i < branches->GetEntriesFast(); ++i) {
+            TBranch* branch = static_cast<TBranch*>(branches->At(i));
+            std::string title = branch->GetTitle();
+            if (title.compare(0, 14, "compact:flags:") != 0)  continue;
+            std::stringstream ss(title.substr(14));
+            std::string flag;
+            for (int bit = 0; std::getline(ss, flag, ','); ++bit)  flags[flag] = {branch->GetName(), bit};
+        }
+        return flags;
+    }
+
+    // Name on disk of a declared branch: itself, its first alias present in the tree, or the packed branch holding it ("" if none)
+    std::string sourceName(TTree* tree, const std::string& name) const {
+        if (tree->GetBranch(name.c_str()))  return name;
+        auto it = aliases.find(name);
+        if (it != aliases.end()) {
+            for (const auto& alias : it->second) {
+                if (tree->GetBranch(alias.c_str()))  return alias;
+            }
+        }
+        auto flags = packedFlags(tree);
+        if (flags.count(name))  return flags.at(name).first;
+        return "";
+    }
+
+    // Set branch addresses for an input tree. Branches with the declared type are bound directly; the others (other on-disk type,
+    // alias, missing branch, compact encoding) go through a staging buffer converted by getEntry.
     void setBranchAddresses(TTree* tree) {
-        for (auto& pair : boolVars)     tree->SetBranchAddress(pair.first.c_str(), &pair.second);
-        for (auto& pair : intVars)      tree->SetBranchAddress(pair.first.c_str(), &pair.second);
-        for (auto& pair : uintVars)     tree->SetBranchAddress(pair.first.c_str(), &pair.second);
-        for (auto& pair : floatVars)    tree->SetBranchAddress(pair.first.c_str(), &pair.second);
-        for (auto& pair : vboolVars)    tree->SetBranchAddress(pair.first.c_str(), &pair.second);
-        for (auto& pair : vintVars)     tree->SetBranchAddress(pair.first.c_str(), &pair.second);
-        for (auto& pair : vfloatVars)   tree->SetBranchAddress(pair.first.c_str(), &pair.second);
+        auto& adapted = staging[tree];
+        adapted.clear();
+        auto flags = packedFlags(tree);
+        std::map<std::string, Staging*> packedStaging;
+        for (const auto& pair : branchList) {
+            const std::string& name = pair.first;
+            std::string source = sourceName(tree, name);
+            std::string diskType = source.empty() ? "" : branchType(tree->GetBranch(source.c_str()));
+            if (source == name && diskType == pair.second) {
+                if (pair.second == "bool")  tree->SetBranchAddress(name.c_str(), &boolVars.at(name));
+                else if (pair.second == "int")  tree->SetBranchAddress(name.c_str(), &intVars.at(name));
+                else if (pair.second == "uint")  tree->SetBranchAddress(name.c_str(), &uintVars.at(name));
+                else if (pair.second == "float")  tree->SetBranchAddress(name.c_str(), &floatVars.at(name));
+                else if (pair.second == "vector<bool>")  tree->SetBranchAddress(name.c_str(), &vboolVars.at(name));
+                else if (pair.second == "vector<int>")  tree->SetBranchAddress(name.c_str(), &vintVars.at(name));
+                else if (pair.second == "vector<float>")  tree->SetBranchAddress(name.c_str(), &vfloatVars.at(name));
+                continue;
+            }
+
+            auto s = std::make_unique<Staging>();
+            s->name = name;
+            s->type = pair.second;
+            s->diskType = diskType;
+            if (source != name && flags.count(name) && flags.at(name).first == source) {
+                // one bit of a packed branch, read once for all its flags
+                auto& packed = packedStaging[source];
+                if (!packed) {
+                    auto p = std::make_unique<Staging>();
+                    p->name = source;
+                    p->diskType = "packed";
+                    tree->SetBranchAddress(source.c_str(), &p->vuc);
+                    packed = p.get();
+                    adapted.push_back(std::move(p));
+                }
+                s->diskType = "flag";
+                s->packed = packed;
+                s->bit = flags.at(name).second;
+            }
+            else if (diskType == "vector<unsigned short>") {
+                tree->SetBranchAddress(source.c_str(), &s->vus);
+                std::string title = tree->GetBranch(source.c_str())->GetTitle();
+                if (title.compare(0, 14, "compact:range:") == 0) {
+                    if (std::sscanf(title.c_str() + 14, "%f,%f,%d", &s->range.min, &s->range.max, &s->range.nbits) != 3) {
+                        throw std::runtime_error("Invalid compact range " + title + " of branch " + source);
+                    }
+                }
+            }
+            else if (diskType == "vector<char>")  tree->SetBranchAddress(source.c_str(), &s->vc);
+            else if (diskType == "vector<short>")  tree->SetBranchAddress(source.c_str(), &s->vs);
+            else if (diskType == "bool")  tree->SetBranchAddress(source.c_str(), &s->b);
+            else if (diskType == "int")  tree->SetBranchAddress(source.c_str(), &s->i);
+            else if (diskType == "uint")  tree->SetBranchAddress(source.c_str(), &s->u);
+            else if (diskType == "float")  tree->SetBranchAddress(source.c_str(), &s->f);
+            else if (diskType == "double")  tree->SetBranchAddress(source.c_str(), &s->d);
+            else if (diskType == "vector<bool>")  tree->SetBranchAddress(source.c_str(), &s->vb);
+            else if (diskType == "vector<int>")  tree->SetBranchAddress(source.c_str(), &s->vi);
+            else if (diskType == "vector<float>")  tree->SetBranchAddress(source.c_str(), &s->vf);
+            else if (diskType == "vector<double>")  tree->SetBranchAddress(source.c_str(), &s->vd);
+            else if (!diskType.empty())  throw std::runtime_error("Unsupported on-disk type " + diskType + " of branch " + source);
+            if (diskType.empty() && !defaults.count(name)) {
+                std::cerr << "** Branch " << name << " missing in the input tree, filled with 0" << std::endl;
+            }
+            adapted.push_back(std::move(s));
+        }
+        if (adapted.empty())  staging.erase(tree);
+    }
+
+    // Read an entry of a tree bound with setBranchAddresses, converting the adapted branches to their declared types
+    int getEntry(TTree* tree, Long64_t entry) {
+        int nbytes = tree->GetEntry(entry);
+        adapt(tree);
+        return nbytes;
+    }
+
+    // Convert the adapted branches of a tree after its branches have been read
+    void adapt(TTree* tree) {
+        auto it = staging.find(tree);
+        if (it == staging.end())  return;
+        for (const auto& s : it->second) {
+            if (s->diskType.empty()) {
+                auto d = defaults.find(s->name);
+                double value = d != defaults.end() ? d->second : 0;
+                if (s->type.compare(0, 7, "vector<") == 0)  assignVector(s->name, s->type, std::vector<float>());
+                else  assignScalar(s->name, s->type, value);
+            }
+            else if (s->diskType == "bool")  assignScalar(s->name, s->type, s->b);
+            else if (s->diskType == "int")  assignScalar(s->name, s->type, s->i);
+            else if (s->diskType == "uint")  assignScalar(s->name, s->type, s->u);
+            else if (s->diskType == "float")  assignScalar(s->name, s->type, s->f);
+            else if (s->diskType == "double")  assignScalar(s->name, s->type, s->d);
+            else if (s->diskType == "vector<bool>" && s->vb)  assignVector(s->name, s->type, *s->vb);
+            else if (s->diskType == "vector<int>" && s->vi)  assignVector(s->name, s->type, *s->vi);
+            else if (s->diskType == "vector<float>" && s->vf)  assignVector(s->name, s->type, *s->vf);
+            else if (s->diskType == "vector<double>" && s->vd)  assignVector(s->name, s->type, *s->vd);
+            else if (s->diskType == "vector<char>" && s->vc)  assignVector(s->name, s->type, *s->vc);
+            else if (s->diskType == "vector<short>" && s->vs)  assignVector(s->name, s->type, *s->vs);
+            else if (s->diskType == "flag" && s->packed->vuc) {
+                s->bits.resize(s->packed->vuc->size());
+                for (size_t i = 0; i < s->bits.size(); ++i)  s->bits[i] = ((*s->packed->vuc)[i] >> s->bit) & 1;
+                assignVector(s->name, s->type, s->bits);
+            }
+            else if (s->diskType == "vector<unsigned short>" && s->vus) {
+                if (s->range.nbits > 0) {
+                    float scale = (s->range.max - s->range.min) / ((1u << s->range.nbits) - 1);
+                    s->decoded.resize(s->vus->size());
+                    for (size_t i = 0; i < s->decoded.size(); ++i)  s->decoded[i] = s->range.min + (*s->vus)[i] * scale;
+                    assignVector(s->name, s->type, s->decoded);
+                }
+                else  assignVector(s->name, s->type, *s->vus);
+            }
+        }
+    }
+
+    // Forget the staging buffers of a tree about to be deleted
+    void unbind(TTree* tree) {
+        staging.erase(tree);
+    }
+
+    template <class T>
+    void assignScalar(const std::string& name, const std::string& type, T value) {
+        if (type == "bool")  boolVars.at(name) = value;
+        else if (type == "int")  intVars.at(name) = value;
+        else if (type == "uint")  uintVars.at(name) = value;
+        else if (type == "float")  floatVars.at(name) = value;
+        else  throw std::runtime_error("Cannot read a scalar into the branch " + name + " of type " + type);
     }
 
-    // Configure branches for an output tree
+    template <class V>
+    void assignVector(const std::string& name, const std::string& type, const V& values) {
+        if (type == "vector<bool>") {
+            auto& vec = vboolVars.at(name);
+            if (!vec)  vec = new std::vector<bool>;
+            vec->assign(values.begin(), values.end());
+        }
+        else if (type == "vector<int>") {
+            auto& vec = vintVars.at(name);
+            if (!vec)  vec = new std::vector<int>;
+            vec->assign(values.begin(), values.end());
+        }
+        else if (type == "vector<float>") {
+            auto& vec = vfloatVars.at(name);
+            if (!vec)  vec = new std::vector<float>;
+            vec->assign(values.begin(), values.end());
+        }
+        else  throw std::runtime_error("Cannot read a vector into the branch " + name + " of type " + type);
+    }
+
+    // Compact encoding of the output branches (empty: none) and its buffers, filled by encodeCompact
+    CompactSchema compact;
+    std::map<std::string, std::vector<unsigned char>> compactFlags;
+    std::map<std::string, std::vector<char>> compactInt8;
+    std::map<std::string, std::vector<short>> compactInt16;
+    std::map<std::string, std::vector<unsigned short>> compactRanges;
+
+    // Configure branches for an output tree, with the compact encoding if any (then encodeCompact must be called before each Fill)
     void setOutputBranch(TTree* tree) {
+        std::map<std::string, std::string> packedIn;
+        for (const auto& group : compact.flags) {
+            if (group.second.size() > 8) {
+                throw std::runtime_error("More than 8 flags packed into " + group.first);
+            }
+            for (const auto& flag : group.second)  packedIn[flag] = group.first;
+        }
+        // packed branches created in this tree (the buffers are shared by all the trees of this EventData)
+        std::set<std::string> packedDone;
         // follow the branch list order
         for (const auto& pair : branchList) {
-            if (pair.second == "bool") {
+            if (packedIn.count(pair.first)) {
+                // packed branch at the position of its first flag
+                const std::string& packed = packedIn.at(pair.first);
+                if (!packedDone.insert(packed).second)  continue;
+                std::string title = "compact:flags:";
+                for (const auto& flag : compact.flags.at(packed))  title += (flag == compact.flags.at(packed).front() ? "" : ",") + flag;
+                tree->Branch(packed.c_str(), &compactFlags[packed], /*bufsize=*/102400)->SetTitle(title.c_str());
+            }
+            else if (compact.ints.count(pair.first)) {
+                if (compact.ints.at(pair.first) == "int8")  tree->Branch(pair.first.c_str(), &compactInt8[pair.first], /*bufsize=*/102400);
+                else if (compact.ints.at(pair.first) == "int16")  tree->Branch(pair.first.c_str(), &compactInt16[pair.first], /*bufsize=*/102400);
+                else  throw std::runtime_error("Invalid compact int type " + compact.ints.at(pair.first) + " of branch " + pair.first);
+            }
+            else if (compact.ranges.count(pair.first)) {
+                const auto& range = compact.ranges.at(pair.first);
+                if (range.nbits < 2 || range.nbits > 16 || range.max <= range.min) {
+                    throw std::runtime_error("Invalid compact range of branch " + pair.first);
+                }
+                tree->Branch(pair.first.c_str(), &compactRanges[pair.first], /*bufsize=*/102400)
+                    ->SetTitle(("compact:range:" + std::to_string(range.min) + "," + std::to_string(range.max) + "," + std::to_string(range.nbits)).c_str());
+            }
+            else if (pair.second == "bool") {
                 tree->Branch(pair.first.c_str(), &boolVars.at(pair.first));
             }
             else if (pair.second == "int") {
@@ -123,6 +475,46 @@ struct EventData {
         }
     }
 
+    // Encode the compact branches of the current event
+    void encodeCompact() {
+        for (auto& pair : compactFlags) {
+            const auto& flags = compact.flags.at(pair.first);
+            pair.second.assign(vboolVars.at(flags.front())->size(), 0);
+            for (size_t bit = 0; bit < flags.size(); ++bit) {
+                const auto& values = *vboolVars.at(flags[bit]);
+                if (values.size() != pair.second.size()) {
+                    throw std::runtime_error("Flags packed into " + pair.first + " have different lengths");
+                }
+                for (size_t i = 0; i < values.size(); ++i)  pair.second[i] |= values[i] << bit;
+            }
+        }
+        narrow(compactInt8);
+        narrow(compactInt16);
+        for (auto& pair : compactRanges) {
+            const auto& range = compact.ranges.at(pair.first);
+            const auto& values = *vfloatVars.at(pair.first);
+            float scale = ((1u << range.nbits) - 1) / (range.max - range.min);
+            pair.second.resize(values.size());
+            for (size_t i = 0; i < values.size(); ++i) {
+                pair.second[i] = std::lround((std::min(std::max(values[i], range.min), range.max) - range.min) * scale);
+            }
+        }
+    }
+
+    template <class T>
+    void narrow(std::map<std::string, std::vector<T>>& buffers) {
+        for (auto& pair : buffers) {
+            const auto& values = *vintVars.at(pair.first);
+            pair.second.resize(values.size());
+            for (size_t i = 0; i < values.size(); ++i) {
+                pair.second[i] = values[i];
+                if (pair.second[i] != values[i]) {
+                    throw std::runtime_error("Value " + std::to_string(values[i]) + " of branch " + pair.first + " out of range of its compact type");
+                }
+            }
+        }
+    }
+
 };
 
 #endif
\ No newline at end of file
@@ -96,6 +96,11 @@ public:
         return label_index;
     }
 
+    // Label names, in the order of the label indices
+    const std::vector<std::string>& labels() const {
+        return labels_;
+    }
+
 private:
 
     void res2PLabel(const Jet *jet, const GenParticle *parton) {
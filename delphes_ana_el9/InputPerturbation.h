@@ -0,0 +1,135 @@
+#ifndef InputPerturbation_h
+#define InputPerturbation_h
+
+#include <cmath>
+#include <map>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Generate randomly perturbed copies of the Sophon raw inputs (particleVars, jetVars) for robustness studies.
+// The copies are meant to be evaluated in one batch via OrtHelperSophon::infer_model_batch.
+struct PerturbationConfig {
+    float d0_smear = 0;     // gaussian smearing of part_d0val, in units of part_d0err
+    float dz_smear = 0;     // gaussian smearing of part_dzval, in units of part_dzerr
+    float energy_scale = 0; // relative gaussian shift of all constituent momenta (one shift per copy); jet kinematics stay nominal
+    float drop_soft_pt = 0; // particles with pt below this value (GeV) are candidates to be dropped
+    float drop_prob = 1;    // probability to drop each soft particle
+    unsigned seed = 42;
+
+    // Parse a spec like "d0=1,dz=1,es=0.02,drop=1,dropprob=0.5,seed=42"
+    static PerturbationConfig parse(const std::string& spec) {
+        PerturbationConfig cfg;
+        std::stringstream ss(spec);
+        std::string item;
+        while (std::getline(ss, item, ',')) {
+            if (item.empty())  continue;
+            auto pos = item.find('=');
+            if (pos == std::string::npos) {
+                throw std::runtime_error("Invalid perturbation item: " + item);
+            }
+            std::string key = item.substr(0, pos);
+            float val = std::stof(item.substr(pos + 1));
+            if (key == "d0")  cfg.d0_smear = val;
+            else if (key == "dz")  cfg.dz_smear = val;
+            else if (key == "es")  cfg.energy_scale = val;
+            else if (key == "drop")  cfg.drop_soft_pt = val;
+            else if (key == "dropprob")  cfg.drop_prob = val;
+            else if (key == "seed")  cfg.seed = (unsigned)val;
+            else  throw std::runtime_error("Invalid perturbation key: " + key);
+        }
+        return cfg;
+    }
+};
+
+class InputPerturbation {
+public:
+    InputPerturbation(const PerturbationConfig& cfg) : cfg_(cfg) {}
+
+    // Fill particleVarsBatch/jetVarsBatch with (1 + nvar) entries: the nominal input at index 0 followed by nvar perturbed copies.
+    // The random stream is seeded by (seed, entry, ijet) so that each jet gets reproducible variations.
+    void generate(const std::map<std::string, std::vector<float>>& particleVars, const std::map<std::string, float>& jetVars, int nvar, long entry, int ijet,
+                  std::vector<std::map<std::string, std::vector<float>>>& particleVarsBatch, std::vector<std::map<std::string, float>>& jetVarsBatch) {
+
+        std::seed_seq seq{cfg_.seed, (unsigned)(entry & 0xffffffff), (unsigned)(entry >> 32), (unsigned)ijet};
+        std::mt19937 rng(seq);
+        std::normal_distribution<float> gaus(0., 1.);
+        std::uniform_real_distribution<float> uniform(0., 1.);
+
+        particleVarsBatch.assign(nvar + 1, particleVars);
+        jetVarsBatch.assign(nvar + 1, jetVars);
+
+        const auto& pt = particleVars.at("part_pt");
+        size_t npart = pt.size();
+        std::vector<char> keep(npart);
+
+        for (int k = 1; k <= nvar; k++) {
+            auto& pv = particleVarsBatch[k];
+
+            // energy-scale shift, shared by all constituents of this copy
+            float scale = 1 + cfg_.energy_scale * gaus(rng);
+            if (cfg_.energy_scale != 0) {
+                for (const char* name : {"part_px", "part_py", "part_pz", "part_energy", "part_pt"}) {
+                    for (auto& v : pv.at(name))  v *= scale;
+                }
+            }
+
+            // impact-parameter smearing in units of the per-particle resolution
+            if (cfg_.d0_smear != 0) {
+                auto& d0 = pv.at("part_d0val");
+                const auto& d0err = pv.at("part_d0err");
+                for (size_t i = 0; i < npart; i++)  d0[i] += cfg_.d0_smear * d0err[i] * gaus(rng);
+            }
+            if (cfg_.dz_smear != 0) {
+                auto& dz = pv.at("part_dzval");
+                const auto& dzerr = pv.at("part_dzerr");
+                for (size_t i = 0; i < npart; i++)  dz[i] += cfg_.dz_smear * dzerr[i] * gaus(rng);
+            }
+
+            // drop soft particles (judged on the nominal pt); particles stay sorted by pt
+            if (cfg_.drop_soft_pt > 0) {
+                size_t nkeep = 0;
+                for (size_t i = 0; i < npart; i++) {
+                    keep[i] = !(pt[i] < cfg_.drop_soft_pt && uniform(rng) < cfg_.drop_prob);
+                    nkeep += keep[i];
+                }
+                if (nkeep < npart) {
+                    for (auto& var : pv) {
+                        auto& vec = var.second;
+                        size_t n = 0;
+                        for (size_t i = 0; i < npart; i++) {
+                            if (keep[i])  vec[n++] = vec[i];
+                        }
+                        vec.resize(n);
+                    }
+                }
+            }
+        }
+    }
+
+    // Per-class mean and standard deviation over the perturbed copies (index 1..nvar) of a flattened (1 + nvar, nclass) output
+    static void summarize(const std::vector<float>& output, size_t nclass, std::vector<float>& mean, std::vector<float>& stddev) {
+        size_t nvar = output.size() / nclass - 1;
+        mean.assign(nclass, 0);
+        stddev.assign(nclass, 0);
+        if (nvar == 0)  return;
+        for (size_t k = 1; k <= nvar; k++) {
+            for (size_t c = 0; c < nclass; c++)  mean[c] += output[k * nclass + c];
+        }
+        for (size_t c = 0; c < nclass; c++)  mean[c] /= nvar;
+        for (size_t k = 1; k <= nvar; k++) {
+            for (size_t c = 0; c < nclass; c++) {
+                float d = output[k * nclass + c] - mean[c];
+                stddev[c] += d * d;
+            }
+        }
+        for (size_t c = 0; c < nclass; c++)  stddev[c] = std::sqrt(stddev[c] / nvar);
+    }
+
+private:
+    PerturbationConfig cfg_;
+};
+
+#endif
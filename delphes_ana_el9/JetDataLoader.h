@@ -0,0 +1,292 @@
+#ifndef JetDataLoader_h
+#define JetDataLoader_h
+
+#include <TFile.h>
+#include <TTree.h>
+#include <TROOT.h>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <map>
+#include <tuple>
+#include <random>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include "nlohmann/json.hpp"
+
+#include "EventData.h"
+#include "MixIO.h"
+#include "SophonPreprocess.h"
+
+// Streaming training data loader over mixed ntuples: nThreads reader threads take the files one by one, read the jet constituents through
+// EventData (only the needed branches, with the input aliases/defaults of SchemaAdaptation), preprocess them with SophonPreprocess (the
+// inputs of the Sophon model, padded / truncated to length particles) and insert them into an in-memory shuffle buffer. next() draws
+// random jets from the full buffer and assembles a batch of contiguous float arrays:
+//  - the model inputs, [batch, channels(i), length] for each input of SophonPreprocess (pf_features, pf_vectors, pf_mask)
+//  - the jet features, [batch, jetFeatures.size()]
+//  - the labels, [batch]
+// The file order is shuffled at each epoch; an epoch ends when all the files are read and the buffer is drained (next() returns 0).
+// The ntuples only store the particle ID flags; part_pid is rebuilt from them for the preprocessing.
+
+
+struct JetDataLoaderConfig {
+    std::vector<std::string> files;
+    std::string inputDirPrefix;
+    std::tuple<float, float> loadRange{0, 1};
+    int nThreads = 4;
+    long shuffleBuffer = 100000;
+    int batchSize = 512;
+    int64_t length = 128;
+    unsigned seed = 42;
+    std::string labelBranch = "jet_label";
+    std::vector<std::string> jetFeatures;
+    SchemaAdaptation schema;
+};
+
+
+// Loader configuration from a json:
+//   {"files": [...], "input_dir_prefix": "...", "load_range": [0, 0.8], "threads": 4, "shuffle_buffer": 100000, "batch_size": 512,
+//    "length": 128, "seed": 42, "label_branch": "jet_label", "jet_features": ["jet_pt", "jet_sdmass"], "input_aliases": {...}, "input_defaults": {...}}
+// or a mix json (the files of all its samples are used).
+JetDataLoaderConfig readLoaderConfig(const nlohmann::json& j) {
+    JetDataLoaderConfig cfg;
+    if (j.contains("files")) {
+        cfg.files = j["files"].get<std::vector<std::string>>();
+    }
+    else {
+        for (auto& element : j.at("samples").items()) {
+            for (auto& file : element.value()["filelist"])  cfg.files.push_back(file);
+        }
+    }
+    cfg.inputDirPrefix = j.value("input_dir_prefix", std::string());
+    if (j.contains("load_range"))  cfg.loadRange = {j["load_range"][0].get<float>(), j["load_range"][1].get<float>()};
+    cfg.nThreads = j.value("threads", cfg.nThreads);
+    cfg.shuffleBuffer = j.value("shuffle_buffer", cfg.shuffleBuffer);
+    cfg.batchSize = j.value("batch_size", cfg.batchSize);
+    cfg.length = j.value("length", cfg.length);
+    cfg.seed = j.value("seed", cfg.seed);
+    cfg.labelBranch = j.value("label_branch", cfg.labelBranch);
+    cfg.jetFeatures = j.value("jet_features", std::vector<std::string>());
+    cfg.schema = readSchemaAdaptation(j);
+    if (cfg.files.empty() || cfg.batchSize <= 0 || cfg.length <= 0) {
+        throw std::runtime_error("Invalid loader configuration: no files, or non-positive batch size or length.");
+    }
+    return cfg;
+}
+
+
+class JetDataLoader {
+public:
+    JetDataLoader(const JetDataLoaderConfig& cfg) : cfg_(cfg) {
+        preprocess_.set_length(cfg_.length);
+        for (size_t i = 0; i < preprocess_.input_names().size(); ++i) {
+            inputSizes_.push_back(preprocess_.channels(i) * cfg_.length);
+            stride_ += inputSizes_.back();
+        }
+        stride_ += cfg_.jetFeatures.size() + 1; // jet features and label
+        capacity_ = std::max(cfg_.shuffleBuffer, 1L);
+        buffer_.resize(capacity_ * stride_);
+
+        branchList_ = {
+            {"part_px", "vector<float>"}, {"part_py", "vector<float>"}, {"part_pz", "vector<float>"}, {"part_energy", "vector<float>"},
+            {"part_deta", "vector<float>"}, {"part_dphi", "vector<float>"}, {"part_d0val", "vector<float>"}, {"part_d0err", "vector<float>"},
+            {"part_dzval", "vector<float>"}, {"part_dzerr", "vector<float>"}, {"part_charge", "vector<int>"},
+            {"part_isElectron", "vector<bool>"}, {"part_isMuon", "vector<bool>"}, {"part_isPhoton", "vector<bool>"},
+            {"jet_pt", "float"}, {"jet_energy", "float"}, {cfg_.labelBranch, "int"}
+        };
+        for (const auto& name : cfg_.jetFeatures) {
+            if (std::none_of(branchList_.begin(), branchList_.end(), [&](const auto& pair) { return pair.first == name; })) {
+                branchList_.emplace_back(name, "float");
+            }
+        }
+        ROOT::EnableThreadSafety();
+        startEpoch();
+    }
+
+    ~JetDataLoader() {
+        stopReaders();
+    }
+
+    const std::vector<std::string>& inputNames() const {
+        return preprocess_.input_names();
+    }
+
+    // Number of floats per jet of the i-th model input (channels x length)
+    long inputSize(size_t i) const {
+        return inputSizes_.at(i);
+    }
+
+    size_t numJetFeatures() const {
+        return cfg_.jetFeatures.size();
+    }
+
+    int batchSize() const {
+        return cfg_.batchSize;
+    }
+
+    // Start a new epoch with a new file order (stops the current one)
+    void startEpoch() {
+        stopReaders();
+        std::vector<size_t> order(cfg_.files.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::mt19937_64 engine(cfg_.seed + epoch_);
+        std::shuffle(order.begin(), order.end(), engine);
+        drawEngine_.seed(cfg_.seed + epoch_ + 1);
+        epoch_++;
+
+        filled_ = 0;
+        stop_ = false;
+        error_ = nullptr;
+        nextFile_ = 0;
+        activeReaders_ = std::max(cfg_.nThreads, 1);
+        for (int t = 0; t < activeReaders_; ++t) {
+            readers_.emplace_back([this, order]() { read(order); });
+        }
+    }
+
+    // Fill the next batch: inputs[i] holds batchSize x inputSize(i) floats, jetFeatures batchSize x numJetFeatures(), labels batchSize.
+    // Returns the number of jets written (less than batchSize for the last batch of the epoch, 0 at the end of the epoch).
+    long next(float* const* inputs, float* jetFeatures, int* labels) {
+        long n = 0;
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (; n < cfg_.batchSize; ++n) {
+            // draw only from a full buffer, except at the end of the epoch
+            cv_.wait(lock, [this] { return filled_ == capacity_ || activeReaders_ == 0 || error_; });
+            if (error_)  std::rethrow_exception(error_);
+            if (filled_ == 0)  break;
+            long k = std::uniform_int_distribution<long>(0, filled_ - 1)(drawEngine_);
+            const float* sample = &buffer_[k * stride_];
+            for (size_t i = 0; i < inputSizes_.size(); ++i) {
+                std::copy(sample, sample + inputSizes_[i], inputs[i] + n * inputSizes_[i]);
+                sample += inputSizes_[i];
+            }
+            std::copy(sample, sample + cfg_.jetFeatures.size(), jetFeatures + n * cfg_.jetFeatures.size());
+            labels[n] = (int)sample[cfg_.jetFeatures.size()];
+            // move the last sample into the freed slot
+            filled_--;
+            if (k != filled_) {
+                std::copy(&buffer_[filled_ * stride_], &buffer_[(filled_ + 1) * stride_], &buffer_[k * stride_]);
+            }
+            cv_.notify_all();
+        }
+        return n;
+    }
+
+private:
+    JetDataLoaderConfig cfg_;
+    SophonPreprocess preprocess_;
+    std::vector<std::pair<std::string, std::string>> branchList_;
+    std::vector<long> inputSizes_;
+    long stride_ = 0;
+    long capacity_ = 0;
+    unsigned epoch_ = 0;
+
+    // shuffle buffer: samples [0, filled_) of stride_ floats (inputs, jet features, label)
+    std::vector<float> buffer_;
+    long filled_ = 0;
+    std::mt19937_64 drawEngine_;
+    std::vector<std::thread> readers_;
+    std::atomic<size_t> nextFile_{0};
+    int activeReaders_ = 0;
+    bool stop_ = false;
+    std::exception_ptr error_ = nullptr;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+
+    void stopReaders() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (auto& t : readers_)  t.join();
+        readers_.clear();
+    }
+
+    void read(const std::vector<size_t>& order) {
+        try {
+            // per-thread preprocessing state and sample buffer
+            SophonPreprocess preprocess = preprocess_;
+            EventData data(branchList_);
+            cfg_.schema.applyTo(data);
+            std::map<std::string, std::vector<float>> particleVars;
+            std::map<std::string, float> jetVars;
+            std::vector<float> sample(stride_);
+            std::vector<float*> outputs;
+            for (size_t i = 0, offset = 0; i < inputSizes_.size(); offset += inputSizes_[i++]) {
+                outputs.push_back(sample.data() + offset);
+            }
+
+            for (size_t f = nextFile_++; f < order.size(); f = nextFile_++) {
+                TFile* file = nullptr;
+                TTree* tree = nullptr;
+                openFile(cfg_.inputDirPrefix + "/" + cfg_.files[order[f]], file, tree, data);
+                // only read the bound branches
+                tree->SetBranchStatus("*", 0);
+                for (const auto& pair : branchList_) {
+                    std::string source = data.sourceName(tree, pair.first);
+                    if (!source.empty())  tree->SetBranchStatus(source.c_str(), 1);
+                }
+                long total = tree->GetEntries();
+                long end = long(total * std::get<1>(cfg_.loadRange));
+                for (long e = long(total * std::get<0>(cfg_.loadRange)); e < end; ++e) {
+                    data.getEntry(tree, e);
+                    makeSample(data, preprocess, particleVars, jetVars, sample, outputs);
+
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    cv_.wait(lock, [this] { return filled_ < capacity_ || stop_; });
+                    if (stop_)  break;
+                    std::copy(sample.begin(), sample.end(), &buffer_[filled_ * stride_]);
+                    filled_++;
+                    cv_.notify_all();
+                }
+                data.unbind(tree);
+                closeFile(file);
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (stop_)  break;
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!error_)  error_ = std::current_exception();
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        activeReaders_--;
+        cv_.notify_all();
+    }
+
+    void makeSample(const EventData& data, SophonPreprocess& preprocess, std::map<std::string, std::vector<float>>& particleVars,
+                    std::map<std::string, float>& jetVars, std::vector<float>& sample, const std::vector<float*>& outputs) {
+        for (const auto& pair : data.vfloatVars) {
+            particleVars[pair.first].assign(pair.second->begin(), pair.second->end());
+        }
+        const auto& charge = *data.vintVars.at("part_charge");
+        particleVars["part_charge"].assign(charge.begin(), charge.end());
+        auto& pid = particleVars["part_pid"];
+        pid.assign(charge.size(), 0);
+        for (size_t i = 0; i < pid.size(); ++i) {
+            if (data.vboolVars.at("part_isElectron")->at(i))  pid[i] = 11;
+            else if (data.vboolVars.at("part_isMuon")->at(i))  pid[i] = 13;
+            else if (data.vboolVars.at("part_isPhoton")->at(i))  pid[i] = 22;
+        }
+        jetVars["jet_pt"] = data.floatVars.at("jet_pt");
+        jetVars["jet_energy"] = data.floatVars.at("jet_energy");
+
+        std::fill(sample.begin(), sample.end(), 0);
+        preprocess.make_input(particleVars, jetVars, outputs);
+        float* tail = sample.data() + stride_ - cfg_.jetFeatures.size() - 1;
+        for (size_t k = 0; k < cfg_.jetFeatures.size(); ++k) {
+            const std::string& name = cfg_.jetFeatures[k];
+            tail[k] = data.floatVars.count(name) ? data.floatVars.at(name) : data.intVars.at(name);
+        }
+        tail[cfg_.jetFeatures.size()] = data.intVars.at(cfg_.labelBranch);
+    }
+};
+
+#endif
@@ -101,6 +101,11 @@ public:
         return label_index;
     }
 
+    // Label names, in the order of the label indices
+    const std::vector<std::string>& labels() const {
+        return labels_;
+    }
+
 private:
 
     void ak4JetLabel(const Jet *jet, std::vector<const GenParticle*> daughters) {
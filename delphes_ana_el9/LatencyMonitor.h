@@ -0,0 +1,79 @@
+#ifndef LatencyMonitor_h
+#define LatencyMonitor_h
+
+#include "TH1F.h"
+#include "TString.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Records per-event (or per-jet) processing latencies for trigger-emulation studies.
+// Latencies are kept in microseconds; percentiles are computed on the full list at the end of the job.
+class LatencyMonitor {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    LatencyMonitor(std::string name, float hist_max_us = 20000, int hist_nbins = 400) : name_(name) {
+        hist_ = new TH1F(("latency_" + name).c_str(), ("latency " + name + ";latency [#mus];entries").c_str(), hist_nbins, 0, hist_max_us);
+    }
+
+    static double elapsed_us(const Clock::time_point& start) {
+        return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+    }
+
+    void record(double latency_us) {
+        latencies_.push_back(latency_us);
+        hist_->Fill(latency_us);
+    }
+
+    double percentile(double q) const {
+        if (latencies_.empty())  return 0;
+        std::vector<double> sorted(latencies_);
+        std::sort(sorted.begin(), sorted.end());
+        size_t rank = std::min(sorted.size() - 1, (size_t)std::ceil(q / 100. * sorted.size()) - (q > 0));
+        return sorted[rank];
+    }
+
+    size_t size() const {
+        return latencies_.size();
+    }
+
+    TH1F* hist() {
+        return hist_;
+    }
+
+    void print() const {
+        std::cerr << TString::Format("** Latency [%s]: n = %zu, p50 = %.1f us, p90 = %.1f us, p99 = %.1f us, max = %.1f us",
+                                     name_.c_str(), latencies_.size(), percentile(50), percentile(90), percentile(99), percentile(100))
+                  << std::endl;
+    }
+
+private:
+    std::string name_;
+    std::vector<double> latencies_;
+    TH1F* hist_ = nullptr; // owned by the current output directory
+};
+
+// Running estimate of the cost of an operation, used to decide ahead of time whether the latency budget would be exceeded
+class LatencyPredictor {
+public:
+    LatencyPredictor(double alpha = 0.05) : alpha_(alpha) {}
+
+    void update(double latency_us) {
+        estimate_ = (n_++ == 0) ? latency_us : (1 - alpha_) * estimate_ + alpha_ * latency_us;
+    }
+
+    double estimate() const {
+        return estimate_;
+    }
+
+private:
+    double alpha_;
+    double estimate_ = 0;
+    long n_ = 0;
+};
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef LazyBranchReader_h
+#define LazyBranchReader_h
+
+#include "TChain.h"
+#include "TClass.h"
+#include "TClonesArray.h"
+#include "TBranchElement.h"
+#include "TFile.h"
+#include "TString.h"
+#include <iostream>
+#include <map>
+#include <string>
+
+// Second phase of the event reading: the heavy Delphes branches (Particle, ParticleFlowCandidate, Vertex) are declared here instead of
+// with ExRootTreeReader::UseBranch, so that ReadEntry only reads the small branches used by the event / jet preselection. load(entry)
+// then reads the heavy branches of the current entry, once the event passed it and before any access to them, including the TRef
+// constituents of the jets. Must be called after treeReader->ReadEntry(entry) (which disables the branches it does not use on a new file).
+class LazyBranchReader {
+public:
+    LazyBranchReader(TChain* chain) : chain_(chain) {}
+
+    ~LazyBranchReader() {
+        for (auto& pair : arrays_)  delete pair.second;
+    }
+
+    // Same as ExRootTreeReader::UseBranch, nullptr if the branch does not exist
+    TClonesArray* useLazy(const char* name) {
+        TBranchElement* branch = dynamic_cast<TBranchElement*>(chain_->GetBranch(name));
+        if (!branch)  return nullptr;
+        TClass* cl = TClass::GetClass(branch->GetClonesName());
+        TClonesArray* array = new TClonesArray(cl, branch->GetMaximum());
+        array->SetName(name);
+        arrays_[name] = array;
+        return array;
+    }
+
+    // Read the lazy branches of an entry (no-op if already read)
+    void load(Long64_t entry) {
+        if (entry == loadedEntry_)  return;
+        Long64_t local = chain_->LoadTree(entry);
+        if (local < 0)  return;
+        if (chain_->GetTreeNumber() != currentTree_) {
+            currentTree_ = chain_->GetTreeNumber();
+            for (auto& pair : arrays_) {
+                chain_->SetBranchStatus(pair.first.c_str(), 1);
+                chain_->SetBranchAddress(pair.first.c_str(), &pair.second);
+            }
+        }
+        for (auto& pair : arrays_) {
+            TBranch* branch = chain_->GetBranch(pair.first.c_str());
+            if (branch)  bytesRead_ += branch->GetEntry(local);
+        }
+        loadedEntry_ = entry;
+        ++numLoaded_;
+    }
+
+    // I/O summary of the job: events with the lazy branches read / skipped, and the (uncompressed) bytes read / saved
+    void print(Long64_t allEntries) const {
+        Long64_t skipped = allEntries - numLoaded_;
+        double perEvent = numLoaded_ > 0 ? double(bytesRead_) / numLoaded_ : 0;
+        std::cerr << TString::Format("** Lazy branches: read for %lld of %lld events (%lld skipped); %.1f MB read, ~%.1f MB saved; %.1f MB read from files in total",
+                                     numLoaded_, allEntries, skipped, bytesRead_ / 1024. / 1024., skipped * perEvent / 1024. / 1024.,
+                                     TFile::GetFileBytesRead() / 1024. / 1024.)
+                  << std::endl;
+    }
+
+private:
+    TChain* chain_;
+    std::map<std::string, TClonesArray*> arrays_;
+    Int_t currentTree_ = -1;
+    Long64_t loadedEntry_ = -1;
+    Long64_t numLoaded_ = 0;
+    Long64_t bytesRead_ = 0;
+};
+
+#endif
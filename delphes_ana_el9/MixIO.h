@@ -0,0 +1,590 @@
+#ifndef MixIO_h
+#define MixIO_h
+
+#include <TFile.h>
+#include <TTree.h>
+#include <TTreeFormula.h>
+#include <TLeaf.h>
+#include <TBranch.h>
+#include <TSystem.h>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <tuple>
+#include <set>
+#include <map>
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <exception>
+#include <memory>
+#include "nlohmann/json.hpp"
+
+#include "EventData.h"
+#include "CompressionPolicy.h"
+
+// Shared I/O helpers of the mixing tools (mixNtuples.C, shuffleNtuples.C): the mix json, ntuple files and per-sample event streams
+
+
+// Adaptation of the input trees to the declared input branch list (see EventData::setBranchAddresses), from the json keys
+//   "input_aliases": {"jet_label": ["label", "jet_class"]}   other names of a branch in older files, tried in order
+//   "input_defaults": {"jet_weight": 1}                      value of a branch missing in a file
+// On-disk types that differ from the declared ones are cast on read (bool/int/uint/float/double, and between vectors of those).
+struct SchemaAdaptation {
+    std::map<std::string, std::vector<std::string>> aliases;
+    std::map<std::string, double> defaults;
+
+    bool empty() const {
+        return aliases.empty() && defaults.empty();
+    }
+
+    void applyTo(EventData& data) const {
+        data.aliases = aliases;
+        data.defaults = defaults;
+    }
+};
+
+
+SchemaAdaptation readSchemaAdaptation(const nlohmann::json& j) {
+    SchemaAdaptation schema;
+    for (auto& element : j.value("input_aliases", nlohmann::json::object()).items()) {
+        if (element.value().is_string())  schema.aliases[element.key()].push_back(element.value());
+        else  schema.aliases[element.key()] = element.value().get<std::vector<std::string>>();
+    }
+    for (auto& element : j.value("input_defaults", nlohmann::json::object()).items()) {
+        schema.defaults[element.key()] = element.value().get<double>();
+    }
+    return schema;
+}
+
+
+// Content of a mix json: per-sample index, nevents_target and filelist, the input/output branch lists, and the order settings
+struct MixConfig {
+    nlohmann::json json;
+    std::vector<std::string> names;
+    std::vector<short> index;
+    std::vector<int> nevents_target;
+    std::vector<std::vector<std::string>> filelist;
+    std::vector<std::pair<std::string, std::string>> branchListIn, branchListOut;
+    SchemaAdaptation schema;
+    CompressionPolicy compression;
+    unsigned seed = 42;
+    std::string orderMode = "shuffle";
+
+    // Number of events to take from each sample within the load range
+    std::vector<long> nevents(const std::tuple<float, float>& loadRange) const {
+        std::vector<long> n;
+        for (size_t i = 0; i < nevents_target.size(); ++i) {
+            n.push_back(int(nevents_target[i] * std::get<1>(loadRange)) - int(nevents_target[i] * std::get<0>(loadRange)));
+        }
+        return n;
+    }
+};
+
+
+MixConfig readMixConfig(const std::string& inputJson) {
+    MixConfig cfg;
+    std::ifstream infile(inputJson);
+    if (!infile) {
+        throw std::runtime_error("Failed to open json: " + inputJson);
+    }
+    infile >> cfg.json;
+    const auto& j = cfg.json;
+
+    for (auto& element : j["samples"].items()) {
+        std::cout << element.key() << " : nevents_target = " << element.value()["nevents_target"] << std::endl;
+        cfg.names.push_back(element.key());
+        cfg.index.push_back(element.value()["index"]);
+        cfg.nevents_target.push_back(element.value()["nevents_target"]);
+        std::vector<std::string> files;
+        for (auto& file : element.value()["filelist"]) {
+            files.push_back(file);
+        }
+        cfg.filelist.push_back(files);
+    }
+    for (const auto& item : j["input_branch_list"]) {
+        cfg.branchListIn.emplace_back(item[0].get<std::string>(), item[1].get<std::string>());
+    }
+    for (const auto& item : j["output_branch_list"]) {
+        cfg.branchListOut.emplace_back(item[0].get<std::string>(), item[1].get<std::string>());
+    }
+    cfg.seed = j.value("seed", 42);
+    cfg.orderMode = j.value("order_mode", std::string("shuffle"));
+    cfg.schema = readSchemaAdaptation(j);
+    if (j.contains("output_compression"))  cfg.compression = readCompressionPolicy(j["output_compression"]);
+    return cfg;
+}
+
+
+long countEntries(const std::string& filePath) {
+    TFile* file = TFile::Open(filePath.c_str(), "READ");
+    if (!file || file->IsZombie()) {
+        throw std::runtime_error("Failed to open file: " + filePath);
+    }
+    TTree* tree = nullptr;
+    file->GetObject("tree", tree);
+    if (!tree) {
+        file->Close();
+        throw std::runtime_error("Failed to get TTree from file: " + filePath);
+    }
+    long n = tree->GetEntries();
+    file->Close();
+    return n;
+}
+
+
+// Fill a tree bound to data_out with the event of data_in (data_out.subsetOf(data_in)) without copying the vectors: they are lent to
+// data_out for the Fill and given back before the next read of the input
+void fillHandOff(EventData& data_in, EventData& data_out, TTree* tree) {
+    data_out.copyScalars(data_in);
+    data_out.swapVectors(data_in);
+    tree->Fill();
+    data_out.swapVectors(data_in);
+}
+
+
+// Catalog of the input files written by makeCatalog.C (entries, sizes, checksums, schema and label counts per file)
+nlohmann::json readCatalog(const std::string& catalogPath) {
+    std::ifstream infile(catalogPath);
+    if (!infile) {
+        throw std::runtime_error("Failed to open catalog: " + catalogPath);
+    }
+    nlohmann::json catalog;
+    infile >> catalog;
+    return catalog;
+}
+
+
+// Check the inputs of a mix against the catalog before reading any event: every file is cataloged and readable, has all the input
+// branches with their types, and each sample has enough events in the load range (from file startFile[i] on, minus startSkip[i]).
+// All the problems are reported together.
+void validateMixInputs(const MixConfig& cfg, const nlohmann::json& catalog, const std::tuple<float, float>& loadRange, const std::vector<long>& nevents,
+                       const std::vector<int>& startFile, const std::vector<long>& startSkip) {
+    if (!catalog.contains("files")) {
+        throw std::runtime_error("Invalid catalog: no \"files\" table");
+    }
+    const auto& files = catalog.at("files");
+    std::vector<std::string> problems;
+    for (size_t i = 0; i < cfg.filelist.size(); ++i) {
+        long available = -startSkip[i];
+        for (size_t f = startFile[i]; f < cfg.filelist[i].size(); ++f) {
+            const std::string& path = cfg.filelist[i][f];
+            if (!files.contains(path)) {
+                problems.push_back(path + ": not in the catalog");
+                continue;
+            }
+            const auto& record = files.at(path);
+            if (record.contains("error")) {
+                problems.push_back(path + ": " + record.at("error").get<std::string>());
+                continue;
+            }
+            if (!record.contains("entries")) {
+                problems.push_back(path + ": no entry count in the catalog");
+                continue;
+            }
+            std::map<std::string, std::string> schema;
+            for (const auto& item : record.value("schema", nlohmann::json::array()))  schema[item[0]] = item[1];
+            for (const auto& pair : cfg.branchListIn) {
+                // the branch or its first alias present, cast on read between scalars or between vectors
+                std::string source = schema.count(pair.first) ? pair.first : "";
+                auto alias = cfg.schema.aliases.find(pair.first);
+                if (source.empty() && alias != cfg.schema.aliases.end()) {
+                    for (const auto& name : alias->second) {
+                        if (schema.count(name)) {
+                            source = name;
+                            break;
+                        }
+                    }
+                }
+                if (source.empty() && record.contains("packed_flags") && record.at("packed_flags").contains(pair.first)) {
+                    // bit of a packed flag branch, expanded on read
+                    if (pair.second != "vector<bool>")  problems.push_back(path + ": branch " + pair.first + " is a packed flag, not " + pair.second);
+                }
+                else if (source.empty()) {
+                    if (!cfg.schema.defaults.count(pair.first))  problems.push_back(path + ": missing branch " + pair.first);
+                }
+                else if ((schema[source].compare(0, 7, "vector<") == 0) != (pair.second.compare(0, 7, "vector<") == 0)) {
+                    problems.push_back(path + ": branch " + source + " is " + schema[source] + ", not " + pair.second);
+                }
+            }
+            long total = record.at("entries");
+            available += long(total * std::get<1>(loadRange)) - long(total * std::get<0>(loadRange));
+        }
+        if (available < nevents[i]) {
+            problems.push_back("sample " + cfg.names[i] + ": " + std::to_string(available) + " events available, " + std::to_string(nevents[i]) + " requested");
+        }
+    }
+    if (!problems.empty()) {
+        for (const auto& p : problems)  std::cerr << "** " << p << std::endl;
+        throw std::runtime_error("Mix inputs failed the catalog validation with " + std::to_string(problems.size()) + " problems.");
+    }
+    std::cout << "Mix inputs validated against the catalog." << std::endl;
+}
+
+
+// Advance the read position of a sample by n events, as SampleReader reads them. The position is (file, skip): the index of the file in the
+// list and the number of events of its load range already read. Only the entry counts of the files are read, from the catalog if it
+// has the file. The file ranges [begin, end) covered are appended to ranges.
+void advanceSample(const std::vector<std::string>& filePaths, const std::string& inputDirPrefix, const std::tuple<float, float>& loadRange, long n,
+                   int& file, long& skip, nlohmann::json& ranges, const nlohmann::json& catalog = nlohmann::json()) {
+    while (n > 0) {
+        if (file >= (int)filePaths.size()) {
+            throw std::runtime_error("Not enough events in the file list: " + std::to_string(n) + " more events requested.");
+        }
+        long total = (catalog.contains("files") && catalog["files"].contains(filePaths[file]) && catalog["files"][filePaths[file]].contains("entries"))
+                     ? catalog["files"][filePaths[file]]["entries"].get<long>() : countEntries(inputDirPrefix + "/" + filePaths[file]);
+        long begin = long(total * std::get<0>(loadRange)), end = long(total * std::get<1>(loadRange));
+        long take = std::max(std::min(n, end - begin - skip), 0L);
+        if (take > 0) {
+            ranges.push_back({{"file", filePaths[file]}, {"begin", begin + skip}, {"end", begin + skip + take}});
+        }
+        n -= take;
+        skip += take;
+        if (skip >= end - begin) {
+            file++;
+            skip = 0;
+        }
+    }
+}
+
+
+void openFile(const std::string& filePath, TFile*& file, TTree*& tree, EventData& data) {
+    file = TFile::Open(filePath.c_str(), "READ");
+    if (!file || file->IsZombie()) {
+        throw std::runtime_error("Failed to open file: " + filePath);
+    }
+
+    tree = nullptr;
+    file->GetObject("tree", tree);
+    if (!tree) {
+        file->Close();
+        throw std::runtime_error("Failed to get TTree from file: " + filePath);
+    }
+    data.setBranchAddresses(tree);
+}
+
+
+void closeFile(TFile*& file) {
+    file->Close();
+    file = nullptr;
+}
+
+
+void createOutputFile(const std::string& filePath, TFile*& file, TTree*& tree, EventData& data, const CompressionPolicy& compression = CompressionPolicy()) {
+    file = TFile::Open(filePath.c_str(), "RECREATE");
+    if (!file || file->IsZombie()) {
+        throw std::runtime_error("Failed to open file: " + filePath);
+    }
+    tree = new TTree("tree", "tree");
+    data.setOutputBranch(tree);
+    compression.applyTo(tree);
+}
+
+
+void writeOutputFile(TFile*& file) {
+    file->Write();
+    file->Close();
+    file = nullptr;
+}
+
+
+// Size, compression ratio and write throughput of the output files of a mixer, printed at the end of the job. Thread-safe.
+class OutputSummary {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    struct FileStats {
+        std::string path;
+        long entries;
+        double totBytes, zipBytes, fileBytes, seconds;
+    };
+
+    // Write and close an output file opened at start, recording its statistics (the tree once written, the file size once closed)
+    void write(TFile*& file, TTree* tree, const Clock::time_point& start) {
+        std::string path = file->GetName();
+        file->Write();
+        FileStats stats{path, (long)tree->GetEntries(), (double)tree->GetTotBytes(), (double)tree->GetZipBytes(), 0, 0};
+        closeFile(file);
+        stats.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        Long64_t size = 0;
+        Long_t id, flags, modtime;
+        if (gSystem->GetPathInfo(path.c_str(), &id, &size, &flags, &modtime) == 0)  stats.fileBytes = size;
+        std::lock_guard<std::mutex> lock(mutex_);
+        files_.push_back(stats);
+    }
+
+    // Record an output written without a ROOT file (a tensor shard), of fileBytes on disk
+    void add(const std::string& path, long entries, double fileBytes, const Clock::time_point& start) {
+        FileStats stats{path, entries, 0, 0, fileBytes, std::chrono::duration<double>(Clock::now() - start).count()};
+        std::lock_guard<std::mutex> lock(mutex_);
+        files_.push_back(stats);
+    }
+
+    size_t size() const {
+        return files_.size();
+    }
+
+    void print() const {
+        std::vector<FileStats> files(files_);
+        std::sort(files.begin(), files.end(), [](const FileStats& a, const FileStats& b) { return a.path < b.path; });
+        FileStats total{"total", 0, 0, 0, 0, 0};
+        std::cout << "Output summary:" << std::endl;
+        for (const auto& f : files) {
+            print(f);
+            total.entries += f.entries;
+            total.totBytes += f.totBytes;
+            total.zipBytes += f.zipBytes;
+            total.fileBytes += f.fileBytes;
+            total.seconds += f.seconds;
+        }
+        print(total);
+    }
+
+private:
+    std::mutex mutex_;
+    std::vector<FileStats> files_;
+
+    static void print(const FileStats& f) {
+        std::cout << TString::Format("  %s: %ld events, %.1f MB written, compression ratio %.2f, %.1f MB/s",
+                                     f.path.c_str(), f.entries, f.fileBytes / 1048576, f.zipBytes > 0 ? f.totBytes / f.zipBytes : 0., f.seconds > 0 ? f.fileBytes / 1048576 / f.seconds : 0.)
+                  << std::endl;
+    }
+};
+
+
+// Selection expression (TTreeFormula syntax on the input tree) of a selection mode: the named modes of the earlier mixers, or the
+// expression itself. An empty expression selects all events.
+std::string selectionExpression(const std::string& selectionMode) {
+    if (selectionMode == "all")  return "";
+    if (selectionMode == "pass_selection")  return "pass_selection>0";
+    if (selectionMode == "msdgt130")  return "jet_sdmass>130";
+    if (selectionMode == "qcdlt0p1")  return "Sum$(jet_probs*(Iteration$>=161&&Iteration$<188))<0.1";
+    return selectionMode;
+}
+
+
+// Stream of the events of one sample; next() returns the next event, valid until the following call
+class EventSource {
+public:
+    virtual ~EventSource() {}
+    virtual EventData& next() = 0;
+    // Whether the event returned by the last next() passes the selection; the branches of a rejected event are only partially read
+    virtual bool passed() const { return true; }
+};
+
+
+// Sequential reader over the file list of one sample, restricted to the load range of each file
+class SampleReader : public EventSource {
+public:
+    SampleReader(int sampleIdx, const std::vector<std::string>& filePaths, const std::string& inputDirPrefix, const std::tuple<float, float>& loadRange, EventData& data) :
+        sampleIdx_(sampleIdx), filePaths_(filePaths), inputDirPrefix_(inputDirPrefix), loadRange_(loadRange), data_(data) {}
+
+    ~SampleReader() {
+        if (file_ != nullptr)  close();
+    }
+
+    // Evaluate the selection expression first, on its own branches only; the other branches are read only for the passing events
+    void setSelection(const std::string& selection) {
+        selection_ = selection;
+    }
+
+    // Skip the first n events of the sample (used to start a shard in the middle of the stream)
+    void skip(long n) {
+        skip_ += n;
+    }
+
+    // Read the next event of the sample into data
+    EventData& next() override {
+        // close the current file if reaching the end of its load range
+        if (file_ != nullptr && eventCount_ >= eventEnd_) {
+            close();
+            std::cout << "File " << filePaths_[fileCount_] << " reading completed." << std::endl;
+            fileCount_++;
+        }
+        // open the next file, skipping whole files if requested
+        while (file_ == nullptr) {
+            if (fileCount_ >= (int)filePaths_.size()) {
+                throw std::runtime_error("No more files to read at index " + std::to_string(fileCount_) + " of sample " + std::to_string(sampleIdx_) + ". This should never happen.");
+            }
+            openFile(inputDirPrefix_ + "/" + filePaths_[fileCount_], file_, tree_, data_);
+            long eventTotalNum = tree_->GetEntries();
+            eventCount_ = long(eventTotalNum * std::get<0>(loadRange_)); // reset event count to the starting point
+            eventEnd_ = long(eventTotalNum * std::get<1>(loadRange_));
+            if (skip_ >= eventEnd_ - eventCount_) {
+                skip_ -= std::max(eventEnd_ - eventCount_, 0L);
+                close();
+                fileCount_++;
+                continue;
+            }
+            eventCount_ += skip_;
+            skip_ = 0;
+            if (!selection_.empty())  compileSelection();
+            std::cout << "Start reading new file at index " << sampleIdx_ << ": " << filePaths_[fileCount_] << ", Total events: " << eventTotalNum << ", Start from pos: " << eventCount_ <<  std::endl;
+        }
+        if (formula_ != nullptr) {
+            // GetNdata/EvalInstance read the branches of the formula for the entry loaded by LoadTree
+            tree_->LoadTree(eventCount_);
+            passed_ = formula_->GetNdata() > 0 && formula_->EvalInstance(0) != 0;
+            if (passed_) {
+                for (auto branch : otherBranches_)  branch->GetEntry(eventCount_);
+            }
+        }
+        else {
+            tree_->GetEntry(eventCount_);
+        }
+        if (passed_)  data_.adapt(tree_);
+        eventCount_++;
+        return data_;
+    }
+
+    bool passed() const override {
+        return passed_;
+    }
+
+    const std::string& currentFile() const {
+        return filePaths_[fileCount_];
+    }
+
+    long currentEntry() const {
+        return eventCount_ - 1;
+    }
+
+private:
+    int sampleIdx_;
+    const std::vector<std::string>& filePaths_;
+    std::string inputDirPrefix_;
+    std::tuple<float, float> loadRange_;
+    EventData& data_;
+    TFile* file_ = nullptr;
+    TTree* tree_ = nullptr;
+    int fileCount_ = 0;
+    long eventCount_ = 0;
+    long eventEnd_ = 0;
+    long skip_ = 0;
+    std::string selection_;
+    TTreeFormula* formula_ = nullptr;
+    std::vector<TBranch*> otherBranches_;
+    bool passed_ = true;
+
+    void compileSelection() {
+        formula_ = new TTreeFormula("selection", selection_.c_str(), tree_);
+        if (formula_->GetNdim() == 0) {
+            throw std::runtime_error("Invalid selection expression: " + selection_);
+        }
+        std::set<TBranch*> formulaBranches;
+        for (int i = 0; i < formula_->GetNcodes(); ++i) {
+            if (formula_->GetLeaf(i))  formulaBranches.insert(formula_->GetLeaf(i)->GetBranch());
+        }
+        // several variables may share a source branch (the flags packed in part_flags): each branch is read once
+        otherBranches_.clear();
+        std::set<TBranch*> seen(formulaBranches);
+        for (const auto& pair : data_.branchList) {
+            std::string source = data_.sourceName(tree_, pair.first);
+            TBranch* branch = source.empty() ? nullptr : tree_->GetBranch(source.c_str());
+            if (branch && seen.insert(branch).second)  otherBranches_.push_back(branch);
+        }
+    }
+
+    void close() {
+        delete formula_;
+        formula_ = nullptr;
+        data_.unbind(tree_);
+        closeFile(file_);
+    }
+};
+
+
+// Reads a fixed number of events of one sample on a background thread into a ring buffer of window EventData records, so that the
+// decompression runs ahead of the mixing loop, which only pops records. The memory per sample is bounded by the window.
+class PrefetchSampleReader : public EventSource {
+public:
+    PrefetchSampleReader(int sampleIdx, const std::vector<std::string>& filePaths, const std::string& inputDirPrefix, const std::tuple<float, float>& loadRange,
+                         std::vector<std::pair<std::string, std::string>>& branchList, long skip, long nevents, size_t window, const std::string& selection = "",
+                         const SchemaAdaptation& schema = SchemaAdaptation()) :
+        data_(branchList), window_(std::max<size_t>(window, 1)), slotPassed_(window_, 1) {
+        schema.applyTo(data_);
+        for (size_t k = 0; k < window_; ++k) {
+            slots_.push_back(std::make_unique<EventData>(branchList));
+        }
+        reader_ = std::make_unique<SampleReader>(sampleIdx, filePaths, inputDirPrefix, loadRange, data_);
+        reader_->skip(skip);
+        reader_->setSelection(selection);
+        thread_ = std::thread([this, nevents]() { produce(nevents); });
+    }
+
+    ~PrefetchSampleReader() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        thread_.join();
+    }
+
+    EventData& next() override {
+        std::unique_lock<std::mutex> lock(mutex_);
+        // release the record returned by the previous call
+        if (popped_) {
+            head_++;
+            popped_ = false;
+            cv_.notify_all();
+        }
+        cv_.wait(lock, [this] { return tail_ > head_ || done_; });
+        if (tail_ == head_) {
+            if (error_)  std::rethrow_exception(error_);
+            throw std::runtime_error("Prefetch reader has no more events. This should never happen.");
+        }
+        popped_ = true;
+        passed_ = slotPassed_[head_ % window_];
+        return *slots_[head_ % window_];
+    }
+
+    bool passed() const override {
+        return passed_;
+    }
+
+private:
+    EventData data_;
+    size_t window_;
+    std::vector<std::unique_ptr<EventData>> slots_;
+    std::vector<char> slotPassed_;
+    bool passed_ = true;
+    std::unique_ptr<SampleReader> reader_;
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    size_t head_ = 0, tail_ = 0;
+    bool popped_ = false, done_ = false, stop_ = false;
+    std::exception_ptr error_ = nullptr;
+
+    void produce(long nevents) {
+        try {
+            for (long k = 0; k < nevents; ++k) {
+                reader_->next();
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] { return tail_ - head_ < window_ || stop_; });
+                if (stop_)  break;
+                // the slot is not visible to the consumer before tail_ is increased; rejected events are not copied
+                lock.unlock();
+                slotPassed_[tail_ % window_] = reader_->passed();
+                if (reader_->passed())  slots_[tail_ % window_]->copy(data_);
+                lock.lock();
+                tail_++;
+                cv_.notify_all();
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            error_ = std::current_exception();
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        done_ = true;
+        cv_.notify_all();
+    }
+};
+
+
+#endif
@@ -0,0 +1,161 @@
+#ifndef MixOrder_h
+#define MixOrder_h
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Counter-based pseudorandom permutation of [0, n): a balanced Feistel network over the smallest even-bit domain covering n,
+// with cycle walking to stay inside [0, n). Any position can be mapped on demand with O(1) memory.
+class FeistelPermutation {
+public:
+    FeistelPermutation(uint64_t n, uint64_t seed, int rounds = 6) : n_(n), rounds_(rounds) {
+        int bits = 2;
+        while (bits < 64 && (uint64_t(1) << bits) < n_)  bits += 2;
+        half_bits_ = bits / 2;
+        half_mask_ = (uint64_t(1) << half_bits_) - 1;
+        uint64_t state = seed;
+        for (int r = 0; r < rounds_; r++)  keys_.push_back(splitmix64(state));
+    }
+
+    uint64_t operator()(uint64_t x) const {
+        if (x >= n_) {
+            throw std::runtime_error("Position " + std::to_string(x) + " out of the permutation range " + std::to_string(n_));
+        }
+        do {
+            x = encrypt(x);
+        } while (x >= n_);
+        return x;
+    }
+
+    uint64_t size() const {
+        return n_;
+    }
+
+private:
+    uint64_t n_;
+    int rounds_;
+    int half_bits_;
+    uint64_t half_mask_;
+    std::vector<uint64_t> keys_;
+
+    static uint64_t splitmix64(uint64_t& state) {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    uint64_t encrypt(uint64_t x) const {
+        uint64_t left = x >> half_bits_, right = x & half_mask_;
+        for (int r = 0; r < rounds_; r++) {
+            uint64_t state = right ^ keys_[r];
+            uint64_t f = splitmix64(state) & half_mask_;
+            uint64_t tmp = right;
+            right = left ^ f;
+            left = tmp;
+        }
+        return (left << half_bits_) | right;
+    }
+};
+
+
+// Order of the samples in the mixed output. Sample s owns the global indices [offset_s, offset_s + nevents_s); output position p takes
+// the event at global index perm(p). Two modes:
+//  - "shuffle": the legacy materialized list of sample indices shuffled by std::shuffle with std::default_random_engine(seed)
+//  - "feistel": FeistelPermutation evaluated on demand, no list is stored
+// The sample of any position is known on demand, but the read offsets of a slice of the output (events taken from each sample before it)
+// are prefix counts over all the earlier positions: buildCheckpoints computes them once, in one pass over the order, every stride positions;
+// a slice starting at a checkpoint then gets its offsets in O(1). The pass is sequential and O(size) in both modes.
+class MixOrder {
+public:
+    MixOrder(const std::vector<long>& nevents, unsigned seed, const std::string& mode = "shuffle") : mode_(mode) {
+        offsets_.push_back(0);
+        for (auto n : nevents)  offsets_.push_back(offsets_.back() + n);
+        if (mode_ == "shuffle") {
+            for (size_t i = 0; i < nevents.size(); ++i) {
+                order_.insert(order_.end(), nevents[i], i);
+            }
+            std::default_random_engine engine(seed);
+            std::shuffle(order_.begin(), order_.end(), engine);
+        }
+        else if (mode_ == "feistel") {
+            perm_ = std::make_unique<FeistelPermutation>(offsets_.back(), seed);
+        }
+        else {
+            throw std::runtime_error("Invalid order mode: " + mode_);
+        }
+    }
+
+    long size() const {
+        return offsets_.back();
+    }
+
+    size_t numSamples() const {
+        return offsets_.size() - 1;
+    }
+
+    // Sample index of the event at output position pos
+    short sampleAt(long pos) const {
+        if (mode_ == "shuffle")  return order_[pos];
+        return locate(pos).first;
+    }
+
+    // (sample index, position within the sample) of the global index behind output position pos. Only available in "feistel" mode,
+    // where the position within the sample is itself pseudorandom; the mixer reads samples sequentially and only uses sampleAt.
+    std::pair<short, long> locate(long pos) const {
+        if (!perm_) {
+            throw std::runtime_error("MixOrder::locate requires the feistel order mode");
+        }
+        long x = (*perm_)(pos);
+        short s = std::upper_bound(offsets_.begin(), offsets_.end(), x) - offsets_.begin() - 1;
+        return {s, x - offsets_[s]};
+    }
+
+    // Sample counts of the output positions [0, k * stride) for k = 0 .. ceil(size / stride)
+    void buildCheckpoints(long stride) {
+        if (stride <= 0) {
+            throw std::runtime_error("Invalid checkpoint stride: " + std::to_string(stride));
+        }
+        std::vector<std::vector<long>> table;
+        std::vector<long> counts(numSamples(), 0);
+        for (long pos = 0; pos < size(); ++pos) {
+            if (pos % stride == 0)  table.push_back(counts);
+            counts[sampleAt(pos)]++;
+        }
+        table.push_back(counts);
+        stride_ = stride;
+        checkpoints_ = std::move(table);
+    }
+
+    long checkpointStride() const {
+        return stride_;
+    }
+
+    // Number of events taken from each sample by the output positions [0, pos): O(pos % stride) from the nearest checkpoint, O(pos) without
+    std::vector<long> countsBefore(long pos) const {
+        long start = 0;
+        std::vector<long> counts(numSamples(), 0);
+        if (stride_ > 0) {
+            start = std::min(pos / stride_, (long)checkpoints_.size() - 1) * stride_;
+            counts = checkpoints_[start / stride_];
+        }
+        for (long p = start; p < pos; ++p)  counts[sampleAt(p)]++;
+        return counts;
+    }
+
+private:
+    std::string mode_;
+    long stride_ = 0;
+    std::vector<std::vector<long>> checkpoints_;
+    std::vector<long> offsets_;
+    std::vector<short> order_;
+    std::unique_ptr<FeistelPermutation> perm_;
+};
+
+#endif
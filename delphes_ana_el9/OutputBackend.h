@@ -0,0 +1,388 @@
+#ifndef OutputBackend_h
+#define OutputBackend_h
+
+#include "TFile.h"
+#include "TTree.h"
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <string>
+#include <memory>
+#include <stdexcept>
+#include <fnmatch.h>
+#include "TSystem.h"
+#include "TString.h"
+
+#include "EventData.h"
+#include "RNTupleIO.h"
+#include "CompressionPolicy.h"
+
+#if __has_include(<arrow/api.h>) && __has_include(<parquet/arrow/writer.h>)
+#define OUTPUTBACKEND_ARROW
+#include <arrow/api.h>
+#include <arrow/io/file.h>
+#include <arrow/ipc/writer.h>
+#include <arrow/util/compression.h>
+#include <parquet/arrow/writer.h>
+#include <parquet/properties.h>
+#endif
+
+// Output backends of the ntuplizers: the branches of an EventData written once per fill() to
+//  - "root": TTree "tree" (EventData::setOutputBranch), the default
+//  - "parquet": Parquet file, one column per branch, vector branches as list columns
+//  - "arrow": Arrow IPC file (feather v2), same columns
+//  - "rntuple": RNTuple "tree" (ROOT >= 6.34), one field per branch
+// The Arrow/Parquet backends need the Arrow C++ headers and libraries (e.g. from conda-forge arrow-cpp/libparquet, loaded with
+// gSystem->Load("libparquet") before compiling the macro). The format may carry options after a colon, e.g. "parquet:rows=50000,compression=zstd,level=3,dictionary=1":
+//  - rows: number of rows per row group / record batch (default 100000)
+//  - compression: zstd (default), lz4, snappy (parquet only), gzip (parquet only) or none
+//  - level: compression level (default: codec default)
+//  - dictionary: dictionary encoding of the Parquet columns (default 1, parquet only)
+// Unknown options and codecs are rejected.
+// For "root", "root:compact=1" writes the particle branches with the compact encoding of jetClassCompactSchema (EventData.h): packed
+// particle-type flags, int8 charge, int16 pid, 16-bit angular distances and impact-parameter errors; "root:policy=balanced,autoflush=-50000000" sets the compression and basket layout of the branches (CompressionPolicy.h).
+// For "rntuple", e.g. "rntuple:compression=505,cluster=100":
+//  - compression: ROOT compression settings (default: RNTuple default, zstd)
+//  - cluster: approximate compressed cluster size in MB (default: RNTuple default)
+
+
+// Throw on an option that the backend of a format does not know
+void checkOutputOptions(const std::string& format, const std::map<std::string, std::string>& options, const std::set<std::string>& known) {
+    for (const auto& pair : options) {
+        if (!known.count(pair.first))  throw std::runtime_error("Unknown option " + pair.first + " of the output format " + format);
+    }
+}
+
+
+class OutputBackend {
+public:
+    virtual ~OutputBackend() {}
+    // Write the current content of the EventData as a new row
+    virtual void fill() = 0;
+    // Flush and close the output
+    virtual void write() = 0;
+    // ROOT file of the output, for additional ROOT objects (nullptr for the other formats)
+    virtual TFile* rootFile() { return nullptr; }
+};
+
+
+class RootOutputBackend : public OutputBackend {
+public:
+    RootOutputBackend(const std::string& path, EventData& data, std::map<std::string, std::string> options) : data_(data) {
+        if (options.count("compact") && options.at("compact") != "0") {
+            data_.compact = jetClassCompactSchema(data_.branchList);
+        }
+        // the other options are those of the compression policy, which rejects the unknown ones
+        options.erase("compact");
+        CompressionPolicy policy = compressionPolicy(options);
+        file_ = new TFile(path.c_str(), "RECREATE");
+        tree_ = new TTree("tree", "tree");
+        data_.setOutputBranch(tree_);
+        policy.applyTo(tree_);
+    }
+
+    ~RootOutputBackend() {
+        delete file_;
+    }
+
+    void fill() override {
+        if (!data_.compact.empty())  data_.encodeCompact();
+        tree_->Fill();
+    }
+
+    void write() override {
+        file_->cd();
+        tree_->Write();
+    }
+
+    TFile* rootFile() override {
+        return file_;
+    }
+
+private:
+    EventData& data_;
+    TFile* file_ = nullptr;
+    TTree* tree_ = nullptr;
+};
+
+
+#ifdef EVENTDATA_RNTUPLE
+
+class RNTupleOutputBackend : public OutputBackend {
+public:
+    RNTupleOutputBackend(const std::string& path, EventData& data, const std::map<std::string, std::string>& options) :
+        writer_(path, data, options.count("compression") ? std::stoi(options.at("compression")) : -1,
+                options.count("cluster") ? std::stod(options.at("cluster")) : 0) {}
+
+    void fill() override {
+        writer_.fill();
+    }
+
+    void write() override {
+        writer_.close();
+    }
+
+private:
+    RNTupleEventWriter writer_;
+};
+
+#endif
+
+
+#ifdef OUTPUTBACKEND_ARROW
+
+class ArrowOutputBackend : public OutputBackend {
+public:
+    ArrowOutputBackend(const std::string& path, const EventData& data, bool parquet, const std::map<std::string, std::string>& options) :
+        data_(data), parquet_(parquet) {
+        rowsPerGroup_ = options.count("rows") ? std::stol(options.at("rows")) : 100000;
+        std::string compression = options.count("compression") ? options.at("compression") : "zstd";
+        int level = options.count("level") ? std::stoi(options.at("level")) : arrow::util::kUseDefaultCompressionLevel;
+        bool dictionary = options.count("dictionary") ? options.at("dictionary") != "0" : true;
+
+        arrow::FieldVector fields;
+        for (const auto& pair : data_.branchList) {
+            std::shared_ptr<arrow::ArrayBuilder> builder;
+            if (pair.second == "bool")  builder = std::make_shared<arrow::BooleanBuilder>();
+            else if (pair.second == "int")  builder = std::make_shared<arrow::Int32Builder>();
+            else if (pair.second == "uint")  builder = std::make_shared<arrow::UInt32Builder>();
+            else if (pair.second == "float")  builder = std::make_shared<arrow::FloatBuilder>();
+            else if (pair.second == "vector<bool>")  builder = std::make_shared<arrow::ListBuilder>(arrow::default_memory_pool(), std::make_shared<arrow::BooleanBuilder>());
+            else if (pair.second == "vector<int>")  builder = std::make_shared<arrow::ListBuilder>(arrow::default_memory_pool(), std::make_shared<arrow::Int32Builder>());
+            else if (pair.second == "vector<float>")  builder = std::make_shared<arrow::ListBuilder>(arrow::default_memory_pool(), std::make_shared<arrow::FloatBuilder>());
+            else  throw std::runtime_error("Arrow output: unsupported type " + pair.second + " of branch " + pair.first);
+            fields.push_back(arrow::field(pair.first, builder->type(), false));
+            builders_.push_back(builder);
+        }
+        schema_ = arrow::schema(fields);
+
+        auto outfile = value(arrow::io::FileOutputStream::Open(path), "open " + path);
+        if (parquet_) {
+            parquet::WriterProperties::Builder props;
+            props.compression(parquetCompression(compression));
+            if (level != arrow::util::kUseDefaultCompressionLevel)  props.compression_level(level);
+            if (dictionary)  props.enable_dictionary();
+            else  props.disable_dictionary();
+            props.max_row_group_length(rowsPerGroup_);
+            parquetWriter_ = value(parquet::arrow::FileWriter::Open(*schema_, arrow::default_memory_pool(), outfile, props.build(),
+                                                                   parquet::ArrowWriterProperties::Builder().store_schema()->build()),
+                                   "create the Parquet writer");
+        }
+        else {
+            auto ipcOptions = arrow::ipc::IpcWriteOptions::Defaults();
+            if (compression != "none") {
+                // the IPC format only supports these two codecs
+                if (compression != "lz4" && compression != "zstd") {
+                    throw std::runtime_error("Invalid Arrow IPC compression: " + compression);
+                }
+                auto codec = compression == "lz4" ? arrow::Compression::LZ4_FRAME : arrow::Compression::ZSTD;
+                ipcOptions.codec = value(arrow::util::Codec::Create(codec, level), "create the compression codec");
+            }
+            ipcWriter_ = value(arrow::ipc::MakeFileWriter(outfile, schema_, ipcOptions), "create the Arrow IPC writer");
+        }
+    }
+
+    void fill() override {
+        for (size_t k = 0; k < data_.branchList.size(); ++k) {
+            const std::string& name = data_.branchList[k].first;
+            const std::string& type = data_.branchList[k].second;
+            arrow::ArrayBuilder* builder = builders_[k].get();
+            if (type == "bool")  check(static_cast<arrow::BooleanBuilder*>(builder)->Append(data_.boolVars.at(name)));
+            else if (type == "int")  check(static_cast<arrow::Int32Builder*>(builder)->Append(data_.intVars.at(name)));
+            else if (type == "uint")  check(static_cast<arrow::UInt32Builder*>(builder)->Append(data_.uintVars.at(name)));
+            else if (type == "float")  check(static_cast<arrow::FloatBuilder*>(builder)->Append(data_.floatVars.at(name)));
+            else {
+                auto list = static_cast<arrow::ListBuilder*>(builder);
+                check(list->Append());
+                if (type == "vector<bool>")  check(static_cast<arrow::BooleanBuilder*>(list->value_builder())->AppendValues(*data_.vboolVars.at(name)));
+                else if (type == "vector<int>") {
+                    const auto& vec = *data_.vintVars.at(name);
+                    check(static_cast<arrow::Int32Builder*>(list->value_builder())->AppendValues(vec.data(), vec.size()));
+                }
+                else {
+                    const auto& vec = *data_.vfloatVars.at(name);
+                    check(static_cast<arrow::FloatBuilder*>(list->value_builder())->AppendValues(vec.data(), vec.size()));
+                }
+            }
+        }
+        if (++rows_ >= rowsPerGroup_)  flush();
+    }
+
+    void write() override {
+        flush();
+        if (parquetWriter_)  check(parquetWriter_->Close());
+        if (ipcWriter_)  check(ipcWriter_->Close());
+        parquetWriter_.reset();
+        ipcWriter_.reset();
+    }
+
+private:
+    const EventData& data_;
+    bool parquet_;
+    long rowsPerGroup_;
+    long rows_ = 0;
+    std::shared_ptr<arrow::Schema> schema_;
+    std::vector<std::shared_ptr<arrow::ArrayBuilder>> builders_;
+    std::unique_ptr<parquet::arrow::FileWriter> parquetWriter_;
+    std::shared_ptr<arrow::ipc::RecordBatchWriter> ipcWriter_;
+
+    // Write the buffered rows as one row group / record batch
+    void flush() {
+        if (rows_ == 0)  return;
+        arrow::ArrayVector arrays;
+        for (auto& builder : builders_) {
+            std::shared_ptr<arrow::Array> array;
+            check(builder->Finish(&array));
+            arrays.push_back(array);
+        }
+        if (parquetWriter_)  check(parquetWriter_->WriteTable(*arrow::Table::Make(schema_, arrays, rows_), rows_));
+        else  check(ipcWriter_->WriteRecordBatch(*arrow::RecordBatch::Make(schema_, rows_, arrays)));
+        rows_ = 0;
+    }
+
+    static parquet::Compression::type parquetCompression(const std::string& name) {
+        if (name == "zstd")  return parquet::Compression::ZSTD;
+        if (name == "lz4")  return parquet::Compression::LZ4;
+        if (name == "snappy")  return parquet::Compression::SNAPPY;
+        if (name == "gzip")  return parquet::Compression::GZIP;
+        if (name == "none")  return parquet::Compression::UNCOMPRESSED;
+        throw std::runtime_error("Invalid Parquet compression: " + name);
+    }
+
+    static void check(const arrow::Status& status) {
+        if (!status.ok()) {
+            throw std::runtime_error("Arrow output: " + status.ToString());
+        }
+    }
+
+    template <class T>
+    static T value(arrow::Result<T> result, const std::string& what) {
+        if (!result.ok()) {
+            throw std::runtime_error("Arrow output: failed to " + what + ": " + result.status().ToString());
+        }
+        return result.MoveValueUnsafe();
+    }
+};
+
+#endif
+
+
+// Output backend of a format string "<format>[:key=value,...]" (see above)
+std::unique_ptr<OutputBackend> makeOutputBackend(const std::string& outputFormat, const std::string& path, EventData& data) {
+    std::string format = outputFormat.substr(0, outputFormat.find(':'));
+    std::map<std::string, std::string> options;
+    if (format.size() < outputFormat.size()) {
+        std::stringstream ss(outputFormat.substr(format.size() + 1));
+        std::string item;
+        while (std::getline(ss, item, ',')) {
+            size_t eq = item.find('=');
+            if (eq == std::string::npos) {
+                throw std::runtime_error("Invalid output option " + item + " in " + outputFormat);
+            }
+            options[item.substr(0, eq)] = item.substr(eq + 1);
+        }
+    }
+
+    if (format == "root" || format.empty()) {
+        return std::make_unique<RootOutputBackend>(path, data, options);
+    }
+    if (format == "rntuple") {
+#ifdef EVENTDATA_RNTUPLE
+        checkOutputOptions(format, options, {"compression", "cluster"});
+        return std::make_unique<RNTupleOutputBackend>(path, data, options);
+#else
+        throw std::runtime_error("Output format rntuple needs ROOT >= 6.34.");
+#endif
+    }
+    if (format == "parquet" || format == "arrow") {
+#ifdef OUTPUTBACKEND_ARROW
+        if (format == "parquet")  checkOutputOptions(format, options, {"rows", "compression", "level", "dictionary"});
+        else  checkOutputOptions(format, options, {"rows", "compression", "level"});
+        return std::make_unique<ArrowOutputBackend>(path, data, format == "parquet", options);
+#else
+        throw std::runtime_error("Output format " + format + " needs the Arrow C++ library, not found at compilation.");
+#endif
+    }
+    throw std::runtime_error("Unknown output format: " + outputFormat);
+}
+
+
+
+// Output split by label group in the same pass: each row goes to the output of the group of its label (int branch labelBranch, an index
+// into labelNames), written with outputFormat to <directory of path>/<group>/<file name of path>. groups is an ordered ';'-separated table
+// "<group>:<pattern>,<pattern>,..." of label-name patterns ('*' wildcard), the first match wins; "jetclass2" stands for the JetClass-II
+// layout "Res34P:X_YY_*;Res2P:X_*;QCD:QCD_*". A group that gets no label is an error. Rows whose label is in no group are dropped. The
+// entries per group are reported by write().
+class LabelRouter : public OutputBackend {
+public:
+    LabelRouter(const std::string& groups, const std::vector<std::string>& labelNames, const std::string& outputFormat, const std::string& path,
+                EventData& data, const std::string& labelBranch = "jet_label") :
+        data_(data), labelBranch_(labelBranch), labelGroup_(labelNames.size(), -1) {
+        std::string table = groups == "jetclass2" ? "Res34P:X_YY_*;Res2P:X_*;QCD:QCD_*" : groups;
+        std::stringstream ss(table);
+        std::string item;
+        while (std::getline(ss, item, ';')) {
+            size_t colon = item.find(':');
+            if (colon == std::string::npos) {
+                throw std::runtime_error("Invalid label group " + item + " in " + groups);
+            }
+            int g = groups_.size();
+            groups_.push_back(item.substr(0, colon));
+            std::stringstream patterns(item.substr(colon + 1));
+            std::string pattern;
+            while (std::getline(patterns, pattern, ',')) {
+                for (size_t l = 0; l < labelNames.size(); ++l) {
+                    if (labelGroup_[l] < 0 && fnmatch(pattern.c_str(), labelNames[l].c_str(), 0) == 0)  labelGroup_[l] = g;
+                }
+            }
+            // most likely a mistyped pattern, which would silently drop the rows of the group
+            if (std::count(labelGroup_.begin(), labelGroup_.end(), g) == 0) {
+                throw std::runtime_error("Label group " + item + " matches no label not already in an earlier group");
+            }
+        }
+
+        size_t slash = path.find_last_of('/');
+        std::string dir = slash == std::string::npos ? "." : path.substr(0, slash);
+        std::string name = path.substr(slash == std::string::npos ? 0 : slash + 1);
+        for (const auto& group : groups_) {
+            gSystem->mkdir((dir + "/" + group).c_str(), true);
+            outputs_.push_back(makeOutputBackend(outputFormat, dir + "/" + group + "/" + name, data));
+        }
+        counts_.assign(groups_.size(), 0);
+    }
+
+    void fill() override {
+        int label = data_.intVars.at(labelBranch_);
+        int g = label >= 0 && label < (int)labelGroup_.size() ? labelGroup_[label] : -1;
+        if (g < 0) {
+            ++dropped_;
+            return;
+        }
+        outputs_[g]->fill();
+        ++counts_[g];
+    }
+
+    void write() override {
+        for (size_t g = 0; g < groups_.size(); ++g) {
+            outputs_[g]->write();
+            std::cerr << TString::Format("** Label group %s: %ld entries", groups_[g].c_str(), counts_[g]) << std::endl;
+        }
+        if (dropped_ > 0) {
+            std::cerr << TString::Format("** %ld entries with a label in no group dropped", dropped_) << std::endl;
+        }
+    }
+
+private:
+    EventData& data_;
+    std::string labelBranch_;
+    std::vector<int> labelGroup_;
+    std::vector<std::string> groups_;
+    std::vector<std::unique_ptr<OutputBackend>> outputs_;
+    std::vector<long> counts_;
+    long dropped_ = 0;
+};
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef RNTupleIO_h
+#define RNTupleIO_h
+
+#include "RVersion.h"
+#include <iostream>
+#include <vector>
+#include <map>
+#include <string>
+#include <memory>
+#include <stdexcept>
+
+#include "EventData.h"
+
+// RNTuple I/O of an EventData (ROOT >= 6.34, where the on-disk format is final): RNTupleEventWriter writes the branches of the branch
+// list as RNTuple fields, RNTupleEventReader reads them back into an EventData (the RNTuple counterpart of setBranchAddresses/getEntry).
+// Only the fields of the branch list are read, missing fields are filled with the EventData defaults as for trees.
+#if __has_include(<ROOT/RNTupleWriter.hxx>) && ROOT_VERSION_CODE >= ROOT_VERSION(6, 34, 0)
+#define EVENTDATA_RNTUPLE
+#include <ROOT/RNTupleModel.hxx>
+#include <ROOT/RNTupleReader.hxx>
+#include <ROOT/RNTupleWriter.hxx>
+#include <ROOT/RNTupleWriteOptions.hxx>
+
+// RNTuple moved out of ROOT::Experimental in 6.36
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6, 36, 0)
+namespace rntuple = ROOT;
+#else
+namespace rntuple = ROOT::Experimental;
+#endif
+
+
+// RNTuple type name of a branch list type
+std::string rntupleFieldType(const std::string& type) {
+    if (type == "bool")  return "bool";
+    if (type == "int")  return "std::int32_t";
+    if (type == "uint")  return "std::uint32_t";
+    if (type == "float")  return "float";
+    if (type == "vector<bool>")  return "std::vector<bool>";
+    if (type == "vector<int>")  return "std::vector<std::int32_t>";
+    if (type == "vector<float>")  return "std::vector<float>";
+    throw std::runtime_error("Invalid branch type: " + type);
+}
+
+
+// Bind the variables of an EventData to the fields of an entry. The vectors must exist (EventData::reset); they are re-bound before each
+// fill / load as they are held by pointer.
+void bindEntry(rntuple::REntry& entry, EventData& data, const std::vector<std::pair<std::string, std::string>>& fields) {
+    for (const auto& pair : fields) {
+        const std::string& name = pair.first;
+        if (pair.second == "bool")  entry.BindRawPtr(name, &data.boolVars.at(name));
+        else if (pair.second == "int")  entry.BindRawPtr(name, &data.intVars.at(name));
+        else if (pair.second == "uint")  entry.BindRawPtr(name, &data.uintVars.at(name));
+        else if (pair.second == "float")  entry.BindRawPtr(name, &data.floatVars.at(name));
+        else if (pair.second == "vector<bool>")  entry.BindRawPtr(name, data.vboolVars.at(name));
+        else if (pair.second == "vector<int>")  entry.BindRawPtr(name, data.vintVars.at(name));
+        else if (pair.second == "vector<float>")  entry.BindRawPtr(name, data.vfloatVars.at(name));
+    }
+}
+
+
+class RNTupleEventWriter {
+public:
+    // compression: ROOT compression settings (e.g. 505 for zstd level 5, -1: RNTuple default); clusterMB: approximate compressed cluster size
+    RNTupleEventWriter(const std::string& path, EventData& data, int compression = -1, double clusterMB = 0, const std::string& ntupleName = "tree") :
+        data_(data) {
+        auto model = rntuple::RNTupleModel::CreateBare();
+        for (const auto& pair : data_.branchList) {
+            model->AddField(rntuple::RFieldBase::Create(pair.first, rntupleFieldType(pair.second)).Unwrap());
+        }
+        rntuple::RNTupleWriteOptions options;
+        if (compression >= 0)  options.SetCompression(compression);
+        if (clusterMB > 0)  options.SetApproxZippedClusterSize(clusterMB * 1024 * 1024);
+        writer_ = rntuple::RNTupleWriter::Recreate(std::move(model), ntupleName, path, options);
+        entry_ = writer_->GetModel().CreateBareEntry();
+    }
+
+    void fill() {
+        bindEntry(*entry_, data_, data_.branchList);
+        writer_->Fill(*entry_);
+    }
+
+    // Commit the dataset and close the file
+    void close() {
+        entry_.reset();
+        writer_.reset();
+    }
+
+private:
+    EventData& data_;
+    std::unique_ptr<rntuple::RNTupleWriter> writer_;
+    std::unique_ptr<rntuple::REntry> entry_;
+};
+
+
+class RNTupleEventReader {
+public:
+    RNTupleEventReader(const std::string& path, EventData& data, const std::string& ntupleName = "tree") : data_(data) {
+        // on-disk fields, to skip (and default) the missing ones
+        std::map<std::string, std::string> diskTypes;
+        {
+            auto probe = rntuple::RNTupleReader::Open(ntupleName, path);
+            const auto& desc = probe->GetDescriptor();
+            for (const auto& field : desc.GetTopLevelFields())  diskTypes[field.GetFieldName()] = field.GetTypeName();
+        }
+
+        auto model = rntuple::RNTupleModel::CreateBare();
+        for (const auto& pair : data_.branchList) {
+            auto it = diskTypes.find(pair.first);
+            if (it == diskTypes.end()) {
+                missing_.push_back(pair);
+                if (!data_.defaults.count(pair.first)) {
+                    std::cerr << "** Field " << pair.first << " missing in " << path << ", filled with 0" << std::endl;
+                }
+                continue;
+            }
+            if (it->second != rntupleFieldType(pair.second)) {
+                throw std::runtime_error("Field " + pair.first + " of " + path + " has type " + it->second + ", expected " + rntupleFieldType(pair.second));
+            }
+            model->AddField(rntuple::RFieldBase::Create(pair.first, it->second).Unwrap());
+            fields_.push_back(pair);
+        }
+        reader_ = rntuple::RNTupleReader::Open(std::move(model), ntupleName, path);
+        entry_ = reader_->GetModel().CreateBareEntry();
+    }
+
+    Long64_t entries() const {
+        return reader_->GetNEntries();
+    }
+
+    void getEntry(Long64_t entry) {
+        data_.reset();
+        bindEntry(*entry_, data_, fields_);
+        reader_->LoadEntry(entry, *entry_);
+        for (const auto& pair : missing_) {
+            auto d = data_.defaults.find(pair.first);
+            if (pair.second.compare(0, 7, "vector<") != 0)  data_.assignScalar(pair.first, pair.second, d != data_.defaults.end() ? d->second : 0.);
+        }
+    }
+
+private:
+    EventData& data_;
+    std::vector<std::pair<std::string, std::string>> fields_, missing_;
+    std::unique_ptr<rntuple::RNTupleReader> reader_;
+    std::unique_ptr<rntuple::REntry> entry_;
+};
+
+#endif
+
+#endif
@@ -0,0 +1,281 @@
+#ifndef TensorShardWriter_h
+#define TensorShardWriter_h
+
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <map>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+#include <mutex>
+#include "nlohmann/json.hpp"
+
+#include "EventData.h"
+
+// Export of mixed events as fixed-stride tensor shards next to (or instead of) the ROOT files, so that training workers can np.load(...,
+// mmap_mode="r") them without parsing and share them through the page cache. Each shard <name>_<idx> is a set of .npy files:
+//  - <name>_<idx>_particles.npy: [N, C, length] float16/float32, the C particle branches, truncated / zero-padded to length particles
+//  - <name>_<idx>_npart.npy: [N] int32, number of particles before truncation (the padding mask is l < min(npart, length))
+//  - <name>_<idx>_jets.npy: [N, J] float32, the J jet branches
+//  - <name>_<idx>_labels.npy: [N] int32, the label branch
+// The index <name>_tensors.json lists the shards with their number of events, the channel and feature names, dtype and length.
+// Configured by the "tensor_export" block of the mix json, e.g.
+//   "tensor_export": {"particles": ["part_deta", "part_dphi", ...], "jets": ["jet_pt", "jet_sdmass"], "label": "jet_label",
+//                     "length": 128, "dtype": "float16", "root_output": true}
+// root_output = false writes the shards only.
+
+
+struct TensorExportConfig {
+    std::vector<std::string> particles, jets;
+    std::string label = "jet_label";
+    int64_t length = 128;
+    bool half = false;
+    bool rootOutput = true;
+};
+
+
+TensorExportConfig readTensorExportConfig(const nlohmann::json& j) {
+    TensorExportConfig cfg;
+    cfg.particles = j.value("particles", std::vector<std::string>());
+    cfg.jets = j.value("jets", std::vector<std::string>());
+    cfg.label = j.value("label", cfg.label);
+    cfg.length = j.value("length", cfg.length);
+    std::string dtype = j.value("dtype", std::string("float32"));
+    if (dtype != "float16" && dtype != "float32") {
+        throw std::runtime_error("Invalid tensor export dtype: " + dtype);
+    }
+    cfg.half = dtype == "float16";
+    cfg.rootOutput = j.value("root_output", true);
+    if (cfg.particles.empty() || cfg.length <= 0) {
+        throw std::runtime_error("Tensor export needs particle branches and a positive length.");
+    }
+    return cfg;
+}
+
+
+// IEEE 754 binary16 of a float, rounded to nearest even
+uint16_t floatToHalf(float value) {
+    uint32_t x;
+    std::memcpy(&x, &value, sizeof(x));
+    uint16_t sign = (x >> 16) & 0x8000;
+    uint32_t exponent = (x >> 23) & 0xff;
+    uint32_t mantissa = x & 0x7fffff;
+    if (exponent == 0xff)  return sign | 0x7c00 | (mantissa ? 0x200 : 0); // inf, nan
+    int e = int(exponent) - 127 + 15;
+    if (e >= 0x1f)  return sign | 0x7c00; // overflow to inf
+    if (e <= 0) {
+        // subnormal or zero
+        if (e < -10)  return sign;
+        mantissa |= 0x800000;
+        int shift = 14 - e;
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1), midpoint = 1u << (shift - 1);
+        if (rest > midpoint || (rest == midpoint && (half & 1)))  half++;
+        return sign | half;
+    }
+    uint32_t half = (e << 10) | (mantissa >> 13);
+    uint32_t rest = mantissa & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))  half++; // may carry into the exponent, up to inf
+    return sign | half;
+}
+
+
+// Writer of one .npy array appended row by row; the number of rows in the header is set by close()
+class NpyWriter {
+public:
+    void open(const std::string& path, const std::string& descr, const std::vector<long>& rowShape) {
+        path_ = path;
+        descr_ = descr;
+        rowShape_ = rowShape;
+        rows_ = 0;
+        out_.open(path, std::ios::binary | std::ios::trunc);
+        if (!out_) {
+            throw std::runtime_error("Failed to open file: " + path);
+        }
+        writeHeader();
+    }
+
+    void write(const void* data, size_t bytes) {
+        out_.write(static_cast<const char*>(data), bytes);
+        rows_++;
+    }
+
+    long close() {
+        out_.seekp(0);
+        writeHeader();
+        out_.close();
+        if (!out_) {
+            throw std::runtime_error("Failed to write file: " + path_);
+        }
+        return rows_;
+    }
+
+private:
+    std::ofstream out_;
+    std::string path_, descr_;
+    std::vector<long> rowShape_;
+    long rows_ = 0;
+
+    // fixed 128-byte header, so that it can be rewritten in place with the final shape
+    void writeHeader() {
+        std::string shape = std::to_string(rows_) + ",";
+        for (size_t k = 0; k < rowShape_.size(); ++k)  shape += (k ? ", " : " ") + std::to_string(rowShape_[k]);
+        std::string dict = "{'descr': '" + descr_ + "', 'fortran_order': False, 'shape': (" + shape + "), }";
+        const size_t headerSize = 128;
+        if (dict.size() + 11 > headerSize) {
+            throw std::runtime_error("Shape too long for the npy header of " + path_);
+        }
+        dict.resize(headerSize - 11, ' ');
+        dict += '\n';
+        uint16_t len = dict.size();
+        out_.write("\x93NUMPY\x01\x00", 8);
+        out_.put(len & 0xff);
+        out_.put(len >> 8);
+        out_.write(dict.data(), dict.size());
+    }
+};
+
+
+// Writes the events of one output file as a tensor shard
+class TensorShardWriter {
+public:
+    TensorShardWriter(const TensorExportConfig& cfg) : cfg_(cfg), particleRow_(cfg.particles.size() * cfg.length), jetRow_(cfg.jets.size()) {}
+
+    bool isOpen() const {
+        return open_;
+    }
+
+    // Paths of the arrays of the shard
+    std::vector<std::string> paths() const {
+        return {basePath_ + "_particles.npy", basePath_ + "_npart.npy", basePath_ + "_jets.npy", basePath_ + "_labels.npy"};
+    }
+
+    // basePath: path of the shard without suffix, e.g. <dir>/<name>_0003
+    void open(const std::string& basePath) {
+        basePath_ = basePath;
+        auto files = paths();
+        particles_.open(files[0], cfg_.half ? "<f2" : "<f4", {(long)cfg_.particles.size(), (long)cfg_.length});
+        npart_.open(files[1], "<i4", {});
+        jets_.open(files[2], "<f4", {(long)cfg_.jets.size()});
+        labels_.open(files[3], "<i4", {});
+        open_ = true;
+    }
+
+    void fill(const EventData& data) {
+        std::fill(particleRow_.begin(), particleRow_.end(), 0.f);
+        int32_t npart = 0;
+        for (size_t c = 0; c < cfg_.particles.size(); ++c) {
+            const std::string& name = cfg_.particles[c];
+            float* row = &particleRow_[c * cfg_.length];
+            if (data.vfloatVars.count(name))  npart = std::max(npart, copyRow(*data.vfloatVars.at(name), row));
+            else if (data.vintVars.count(name))  npart = std::max(npart, copyRow(*data.vintVars.at(name), row));
+            else if (data.vboolVars.count(name))  npart = std::max(npart, copyRow(*data.vboolVars.at(name), row));
+            else  throw std::runtime_error("Tensor export: no vector branch " + name);
+        }
+        if (cfg_.half) {
+            halfRow_.resize(particleRow_.size());
+            std::transform(particleRow_.begin(), particleRow_.end(), halfRow_.begin(), floatToHalf);
+            particles_.write(halfRow_.data(), halfRow_.size() * sizeof(uint16_t));
+        }
+        else {
+            particles_.write(particleRow_.data(), particleRow_.size() * sizeof(float));
+        }
+        npart_.write(&npart, sizeof(npart));
+
+        for (size_t k = 0; k < cfg_.jets.size(); ++k)  jetRow_[k] = scalar(data, cfg_.jets[k]);
+        jets_.write(jetRow_.data(), jetRow_.size() * sizeof(float));
+        int32_t label = scalar(data, cfg_.label);
+        labels_.write(&label, sizeof(label));
+    }
+
+    // Close the shard and return its index record
+    nlohmann::json close() {
+        long n = particles_.close();
+        npart_.close();
+        jets_.close();
+        labels_.close();
+        open_ = false;
+        std::string name = basePath_.substr(basePath_.find_last_of('/') + 1);
+        return {{"name", name}, {"entries", n}};
+    }
+
+private:
+    const TensorExportConfig& cfg_;
+    NpyWriter particles_, npart_, jets_, labels_;
+    std::vector<float> particleRow_, jetRow_;
+    std::vector<uint16_t> halfRow_;
+    std::string basePath_;
+    bool open_ = false;
+
+    template <class T>
+    int32_t copyRow(const std::vector<T>& values, float* row) {
+        size_t n = std::min<size_t>(values.size(), cfg_.length);
+        for (size_t l = 0; l < n; ++l)  row[l] = values[l];
+        return values.size();
+    }
+
+    static float scalar(const EventData& data, const std::string& name) {
+        if (data.floatVars.count(name))  return data.floatVars.at(name);
+        if (data.intVars.count(name))  return data.intVars.at(name);
+        if (data.uintVars.count(name))  return data.uintVars.at(name);
+        if (data.boolVars.count(name))  return data.boolVars.at(name);
+        throw std::runtime_error("Tensor export: no scalar branch " + name);
+    }
+};
+
+
+// Index of the shards written by all the writers of a mix (shared between the workers)
+class TensorIndex {
+public:
+    TensorIndex(const TensorExportConfig& cfg) : cfg_(cfg) {}
+
+    const TensorExportConfig& config() const {
+        return cfg_;
+    }
+
+    void add(const nlohmann::json& shard) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        shards_.push_back(shard);
+    }
+
+    // Write the index, keeping the shards of an existing index of the same layout (e.g. from an earlier append)
+    void write(const std::string& indexPath) {
+        nlohmann::json index;
+        std::ifstream infile(indexPath);
+        if (infile) {
+            infile >> index;
+        }
+        nlohmann::json layout = {{"particles", cfg_.particles}, {"jets", cfg_.jets}, {"label", cfg_.label}, {"length", cfg_.length},
+                                 {"dtype", cfg_.half ? "float16" : "float32"}};
+        if (!index.is_null() && index["layout"] != layout) {
+            throw std::runtime_error("Tensor index " + indexPath + " has another layout.");
+        }
+        index["layout"] = layout;
+        std::map<std::string, nlohmann::json> shards;
+        for (const auto& shard : index.value("shards", nlohmann::json::array()))  shards[shard["name"]] = shard;
+        for (const auto& shard : shards_)  shards[shard["name"]] = shard;
+        index["shards"] = nlohmann::json::array();
+        long total = 0;
+        for (const auto& pair : shards) {
+            index["shards"].push_back(pair.second);
+            total += pair.second["entries"].get<long>();
+        }
+        index["entries"] = total;
+        std::ofstream outfile(indexPath);
+        if (!outfile) {
+            throw std::runtime_error("Failed to write tensor index: " + indexPath);
+        }
+        outfile << index.dump(1) << std::endl;
+        std::cout << "Tensor index of " << index["shards"].size() << " shards (" << total << " events) written to " << indexPath << std::endl;
+    }
+
+private:
+    TensorExportConfig cfg_;
+    std::mutex mutex_;
+    std::vector<nlohmann::json> shards_;
+};
+
+#endif
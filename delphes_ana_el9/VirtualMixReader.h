@@ -0,0 +1,218 @@
+#ifndef VirtualMixReader_h
+#define VirtualMixReader_h
+
+#include <TFile.h>
+#include <TTree.h>
+#include <TNamed.h>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <list>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <stdexcept>
+#include <memory>
+#include "nlohmann/json.hpp"
+
+#include "EventData.h"
+#include "MixIO.h"
+
+// Virtual mix: instead of copying the events, a mix is stored as an index file (written by makeMixIndex.C) with
+//  - TTree "index": one entry per mixed event, in mixing order, with the branches file_id (int) and entry (Long64_t), and optionally
+//    weight (float, e.g. from stratifyNtuples.C)
+//  - TNamed "mix_index_meta": json with the file table ("files": path, sample, entries), the samples (index/label, nevents),
+//    the branch lists, load range, seed and order mode of the mix, the input directory prefix, and the input aliases and defaults
+//    of the mix json (see SchemaAdaptation)
+// VirtualMixReader resolves the index lazily: input files are kept open in an LRU cache and the next files needed by the index
+// are opened ahead with TFile::AsyncOpen.
+
+
+class VirtualMixReader {
+public:
+    // inputDirPrefix overrides the prefix stored in the index if not empty. cacheSize is the number of input files kept open
+    // (0: two per sample, and at least one per stratum of a stratified index); prefetchFiles is the number of upcoming files opened ahead.
+    VirtualMixReader(const std::string& indexPath, const std::string& inputDirPrefix = "", size_t cacheSize = 0, size_t prefetchFiles = 2) :
+        prefetchFiles_(prefetchFiles) {
+        indexFile_ = TFile::Open(indexPath.c_str(), "READ");
+        if (!indexFile_ || indexFile_->IsZombie()) {
+            throw std::runtime_error("Failed to open index file: " + indexPath);
+        }
+        TNamed* meta = nullptr;
+        indexFile_->GetObject("mix_index_meta", meta);
+        indexFile_->GetObject("index", indexTree_);
+        if (!meta || !indexTree_) {
+            throw std::runtime_error("Invalid mix index file: " + indexPath);
+        }
+        meta_ = nlohmann::json::parse(meta->GetTitle());
+        std::string prefix = inputDirPrefix.empty() ? meta_["input_dir_prefix"].get<std::string>() : inputDirPrefix;
+        for (const auto& f : meta_["files"]) {
+            filePaths_.push_back(prefix + "/" + f["path"].get<std::string>());
+        }
+        for (const auto& item : meta_["input_branch_list"]) {
+            branchListIn_.emplace_back(item[0].get<std::string>(), item[1].get<std::string>());
+        }
+        for (const auto& item : meta_["output_branch_list"]) {
+            branchListOut_.emplace_back(item[0].get<std::string>(), item[1].get<std::string>());
+        }
+        cacheSize_ = cacheSize > 0 ? cacheSize : std::max<size_t>(2 * std::max<size_t>(meta_["samples"].size(), 1), meta_.value("num_strata", 0UL));
+        indexTree_->SetBranchAddress("file_id", &indexFileId_);
+        indexTree_->SetBranchAddress("entry", &indexEntry_);
+        if (indexTree_->GetBranch("weight")) {
+            indexTree_->SetBranchAddress("weight", &indexWeight_);
+        }
+        data_ = std::make_unique<EventData>(branchListIn_);
+        readSchemaAdaptation(meta_).applyTo(*data_);
+    }
+
+    ~VirtualMixReader() {
+        for (auto& pair : cache_) {
+            pair.second.file->Close();
+        }
+        for (auto& pair : pending_) {
+            TFile* file = TFile::Open(pair.second);
+            if (file)  file->Close();
+        }
+        indexFile_->Close();
+    }
+
+    Long64_t entries() const {
+        return indexTree_->GetEntries();
+    }
+
+    const nlohmann::json& meta() const {
+        return meta_;
+    }
+
+    std::vector<std::pair<std::string, std::string>>& branchListIn() {
+        return branchListIn_;
+    }
+
+    std::vector<std::pair<std::string, std::string>>& branchListOut() {
+        return branchListOut_;
+    }
+
+    // Read the i-th event of the mix; the returned data is valid until the next call
+    const EventData& getEntry(Long64_t i) {
+        loadChunk(i);
+        const auto& loc = chunk_[i - chunkBegin_];
+        TTree* tree = acquire(loc.first);
+        if (data_->getEntry(tree, loc.second) <= 0) {
+            throw std::runtime_error("Failed to read entry " + std::to_string(loc.second) + " of file " + filePaths_[loc.first]);
+        }
+        weight_ = chunkWeights_[i - chunkBegin_];
+        prefetch(i);
+        return *data_;
+    }
+
+    // Whether the index has per-event weights, and the weight of the event read by the last getEntry (1 without weights)
+    bool weighted() const {
+        return meta_.value("weighted", false);
+    }
+
+    float weight() const {
+        return weight_;
+    }
+
+private:
+    struct CachedFile {
+        TFile* file;
+        TTree* tree;
+        std::list<int>::iterator lru;
+    };
+
+    static constexpr Long64_t chunkSize_ = 100000;
+
+    TFile* indexFile_ = nullptr;
+    TTree* indexTree_ = nullptr;
+    int indexFileId_ = 0;
+    Long64_t indexEntry_ = 0;
+    float indexWeight_ = 1;
+    float weight_ = 1;
+    nlohmann::json meta_;
+    std::vector<std::string> filePaths_;
+    std::vector<std::pair<std::string, std::string>> branchListIn_, branchListOut_;
+    std::unique_ptr<EventData> data_;
+    size_t cacheSize_;
+    size_t prefetchFiles_;
+
+    // index entries [chunkBegin_, chunkBegin_ + chunk_.size()), read in chunks to keep the memory independent of the mix size
+    Long64_t chunkBegin_ = -1;
+    std::vector<std::pair<int, Long64_t>> chunk_;
+    std::vector<float> chunkWeights_;
+
+    std::unordered_map<int, CachedFile> cache_;
+    std::list<int> lru_; // most recently used first
+    std::map<int, TFileOpenHandle*> pending_;
+    Long64_t prefetchPos_ = 0;
+
+    void loadChunk(Long64_t i) {
+        if (i < 0 || i >= entries()) {
+            throw std::runtime_error("Entry " + std::to_string(i) + " out of the mix index range " + std::to_string(entries()));
+        }
+        if (chunkBegin_ >= 0 && i >= chunkBegin_ && i < chunkBegin_ + (Long64_t)chunk_.size())  return;
+        chunkBegin_ = i - i % chunkSize_;
+        Long64_t end = std::min(chunkBegin_ + chunkSize_, entries());
+        chunk_.clear();
+        chunkWeights_.clear();
+        for (Long64_t k = chunkBegin_; k < end; ++k) {
+            indexTree_->GetEntry(k);
+            chunk_.emplace_back(indexFileId_, indexEntry_);
+            chunkWeights_.push_back(indexWeight_);
+        }
+    }
+
+    TTree* acquire(int fileId) {
+        auto it = cache_.find(fileId);
+        if (it != cache_.end()) {
+            lru_.splice(lru_.begin(), lru_, it->second.lru);
+            return it->second.tree;
+        }
+
+        TFile* file = nullptr;
+        auto handle = pending_.find(fileId);
+        if (handle != pending_.end()) {
+            file = TFile::Open(handle->second);
+            pending_.erase(handle);
+        }
+        else {
+            file = TFile::Open(filePaths_.at(fileId).c_str(), "READ");
+        }
+        if (!file || file->IsZombie()) {
+            throw std::runtime_error("Failed to open file: " + filePaths_.at(fileId));
+        }
+        TTree* tree = nullptr;
+        file->GetObject("tree", tree);
+        if (!tree) {
+            file->Close();
+            throw std::runtime_error("Failed to get TTree from file: " + filePaths_.at(fileId));
+        }
+        // all open trees fill the same EventData
+        data_->setBranchAddresses(tree);
+
+        while (cache_.size() >= cacheSize_) {
+            int last = lru_.back();
+            data_->unbind(cache_.at(last).tree);
+            cache_.at(last).file->Close();
+            cache_.erase(last);
+            lru_.pop_back();
+        }
+        lru_.push_front(fileId);
+        cache_[fileId] = CachedFile{file, tree, lru_.begin()};
+        return tree;
+    }
+
+    // Start opening the next files of the index after entry i that are neither open nor pending, up to prefetchFiles_ pending files.
+    // Each index entry is examined once, so the cost per event stays constant.
+    void prefetch(Long64_t i) {
+        if (prefetchFiles_ == 0)  return;
+        Long64_t end = chunkBegin_ + (Long64_t)chunk_.size();
+        for (prefetchPos_ = std::max(prefetchPos_, i + 1); prefetchPos_ < end && pending_.size() < prefetchFiles_; ++prefetchPos_) {
+            int fileId = chunk_[prefetchPos_ - chunkBegin_].first;
+            if (cache_.count(fileId) || pending_.count(fileId))  continue;
+            pending_[fileId] = TFile::AsyncOpen(filePaths_.at(fileId).c_str(), "READ");
+        }
+    }
+};
+
+#endif
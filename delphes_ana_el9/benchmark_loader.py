@@ -0,0 +1,164 @@
+import argparse
+import ctypes
+import json
+import os
+import time
+
+import numpy as np
+
+parser = argparse.ArgumentParser('Benchmark of the C++ training data loader (JetDataLoader.C) against the uproot + numpy pipeline')
+parser.add_argument('-c', '--config', required=True, help='Loader json (see readLoaderConfig in JetDataLoader.h) or mix json.')
+parser.add_argument('-l', '--lib', default='./libJetDataLoader.so', help='Shared library built from JetDataLoader.C.')
+parser.add_argument('-n', '--num-batches', type=int, default=200, help='Number of batches to time for each loader.')
+parser.add_argument('--skip-uproot', action='store_true', help='Only time the C++ loader.')
+parser.add_argument('--validate', action='store_true',
+                    help='Compare the preprocessed inputs of both loaders on the first batch of the first file.')
+args = parser.parse_args()
+
+
+class JetDataLoader:
+    """ctypes wrapper of the C interface of JetDataLoader.C; next() returns numpy arrays (inputs, jet features, labels)."""
+
+    def __init__(self, lib_path, config):
+        self.lib = ctypes.CDLL(os.path.abspath(lib_path))
+        self.lib.jdl_create.restype = ctypes.c_void_p
+        self.lib.jdl_create.argtypes = [ctypes.c_char_p]
+        self.lib.jdl_last_error.restype = ctypes.c_char_p
+        for f in ['jdl_batch_size', 'jdl_num_inputs', 'jdl_num_jet_features', 'jdl_start_epoch']:
+            getattr(self.lib, f).argtypes = [ctypes.c_void_p]
+        self.lib.jdl_input_size.restype = ctypes.c_long
+        self.lib.jdl_input_size.argtypes = [ctypes.c_void_p, ctypes.c_int]
+        self.lib.jdl_input_name.restype = ctypes.c_char_p
+        self.lib.jdl_input_name.argtypes = [ctypes.c_void_p, ctypes.c_int]
+        self.lib.jdl_next.restype = ctypes.c_long
+        self.lib.jdl_next.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.POINTER(ctypes.c_float)),
+                                      ctypes.POINTER(ctypes.c_float), ctypes.POINTER(ctypes.c_int)]
+        self.lib.jdl_destroy.argtypes = [ctypes.c_void_p]
+
+        self.loader = self.lib.jdl_create(json.dumps(config).encode())
+        if not self.loader:
+            raise RuntimeError(self.lib.jdl_last_error().decode())
+        self.batch_size = self.lib.jdl_batch_size(self.loader)
+        self.length = config.get('length', 128)
+        self.names = [self.lib.jdl_input_name(self.loader, i).decode() for i in range(self.lib.jdl_num_inputs(self.loader))]
+        self.inputs = [np.zeros((self.batch_size, self.lib.jdl_input_size(self.loader, i) // self.length, self.length), dtype=np.float32)
+                       for i in range(len(self.names))]
+        self.jet_features = np.zeros((self.batch_size, self.lib.jdl_num_jet_features(self.loader)), dtype=np.float32)
+        self.labels = np.zeros(self.batch_size, dtype=np.int32)
+        self.input_ptrs = (ctypes.POINTER(ctypes.c_float) * len(self.inputs))(
+            *[a.ctypes.data_as(ctypes.POINTER(ctypes.c_float)) for a in self.inputs])
+
+    def next(self):
+        n = self.lib.jdl_next(self.loader, self.input_ptrs, self.jet_features.ctypes.data_as(ctypes.POINTER(ctypes.c_float)),
+                              self.labels.ctypes.data_as(ctypes.POINTER(ctypes.c_int)))
+        if n < 0:
+            raise RuntimeError(self.lib.jdl_last_error().decode())
+        if n == 0:
+            return None
+        return {name: a[:n] for name, a in zip(self.names, self.inputs)}, self.jet_features[:n], self.labels[:n]
+
+    def __del__(self):
+        if getattr(self, 'loader', None):
+            self.lib.jdl_destroy(self.loader)
+
+
+def preprocess_numpy(arrays, length):
+    """Same preprocessing as SophonPreprocess.h on awkward arrays, padded to length particles."""
+    import awkward as ak
+
+    def pad(x):
+        return ak.to_numpy(ak.fill_none(ak.pad_none(x, length, clip=True), 0)).astype(np.float32)
+
+    jet_pt, jet_energy = arrays['jet_pt'], arrays['jet_energy']
+    px, py, pz = arrays['part_px'] / jet_pt * 500, arrays['part_py'] / jet_pt * 500, arrays['part_pz'] / jet_pt * 500
+    energy = arrays['part_energy'] / jet_pt * 500
+    pt = np.hypot(arrays['part_px'], arrays['part_py'])
+    is_ele, is_mu, is_pho = arrays['part_isElectron'], arrays['part_isMuon'], arrays['part_isPhoton']
+    charge = arrays['part_charge']
+    # (value, subtract, multiply, clip_min, clip_max)
+    features = [
+        (np.log(np.hypot(px, py)), 1.7, 0.7, -5, 5),
+        (np.log(energy), 2.0, 0.7, -5, 5),
+        (np.log(pt / jet_pt), -4.7, 0.7, -5, 5),
+        (np.log(arrays['part_energy'] / jet_energy), -4.7, 0.7, -5, 5),
+        (np.hypot(arrays['part_deta'], arrays['part_dphi']), 0.2, 4.0, -5, 5),
+        (charge, 0, 1, -1e8, 1e8),
+        ((charge != 0) & ~is_ele & ~is_mu, 0, 1, -1e8, 1e8),
+        ((charge == 0) & ~is_pho, 0, 1, -1e8, 1e8),
+        (is_pho, 0, 1, -1e8, 1e8),
+        (is_ele, 0, 1, -1e8, 1e8),
+        (is_mu, 0, 1, -1e8, 1e8),
+        (np.tanh(arrays['part_d0val']), 0, 1, -1e8, 1e8),
+        (arrays['part_d0err'], 0, 1, 0, 1),
+        (np.tanh(arrays['part_dzval']), 0, 1, -1e8, 1e8),
+        (arrays['part_dzerr'], 0, 1, 0, 1),
+        (arrays['part_deta'], 0, 1, -1e8, 1e8),
+        (arrays['part_dphi'], 0, 1, -1e8, 1e8),
+    ]
+    mask = pad(ak.ones_like(arrays['part_px']))
+    pf_features = np.stack([np.clip((pad(v) - s) * m, lo, hi) * mask for v, s, m, lo, hi in features], axis=1)
+    pf_vectors = np.stack([pad(v) for v in (px, py, pz, energy)], axis=1)
+    return {'pf_features': pf_features, 'pf_vectors': pf_vectors, 'pf_mask': mask[:, None, :]}
+
+
+def uproot_batches(config, num_batches):
+    """Current pipeline: uproot reads the files in chunks, numpy/awkward preprocessing, batches sliced from the chunk."""
+    import uproot
+    branches = ['part_px', 'part_py', 'part_pz', 'part_energy', 'part_deta', 'part_dphi', 'part_d0val', 'part_d0err', 'part_dzval',
+                'part_dzerr', 'part_charge', 'part_isElectron', 'part_isMuon', 'part_isPhoton', 'jet_pt', 'jet_energy',
+                config.get('label_branch', 'jet_label')] + config.get('jet_features', [])
+    files = [os.path.join(config.get('input_dir_prefix', ''), f) + ':tree' for f in config['files']]
+    batch_size, length = config.get('batch_size', 512), config.get('length', 128)
+    n = 0
+    for arrays in uproot.iterate(files, list(dict.fromkeys(branches)), step_size=batch_size * 20):
+        inputs = preprocess_numpy(arrays, length)
+        for start in range(0, len(arrays), batch_size):
+            yield {k: v[start:start + batch_size] for k, v in inputs.items()}
+            n += 1
+            if n >= num_batches:
+                return
+
+
+def timed(batches, num_batches):
+    start = time.time()
+    n = njets = 0
+    for batch in batches:
+        njets += len(batch['pf_mask'])
+        n += 1
+        if n >= num_batches:
+            break
+    elapsed = time.time() - start
+    return n, njets, elapsed
+
+
+with open(args.config) as f:
+    config = json.load(f)
+if 'files' not in config:
+    config['files'] = [f for s in config['samples'].values() for f in s['filelist']]
+
+if args.validate:
+    # one file, one thread and a buffer of one jet: the C++ loader returns the jets in file order
+    single = dict(config, files=config['files'][:1], threads=1, shuffle_buffer=1)
+    loader = JetDataLoader(args.lib, single)
+    cpp = loader.next()[0]
+    ref = next(uproot_batches(single, 1))
+    for name in cpp:
+        diff = np.abs(cpp[name] - ref[name]).max()
+        print(f'{name}: max abs difference {diff:.3g}')
+    del loader
+
+
+def cpp_batches():
+    loader = JetDataLoader(args.lib, config)
+    while True:
+        batch = loader.next()
+        if batch is None:
+            return
+        yield batch[0]
+
+
+n, njets, elapsed = timed(cpp_batches(), args.num_batches)
+print(f'C++ loader ({config.get("threads", 4)} threads): {n} batches, {njets} jets in {elapsed:.2f} s: {n / elapsed:.1f} batches/s, {njets / elapsed:.0f} jets/s')
+if not args.skip_uproot:
+    n, njets, elapsed = timed(uproot_batches(config, args.num_batches), args.num_batches)
+    print(f'uproot + numpy: {n} batches, {njets} jets in {elapsed:.2f} s: {n / elapsed:.1f} batches/s, {njets / elapsed:.0f} jets/s')
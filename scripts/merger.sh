@@ -1,28 +1,13 @@
 if [[ -z $1 ]]; then
-    echo "Usage: ./merger.sh <dataset>"
+    echo "Usage: ./merger.sh <dataset> [target file size in MB, 0: groups of 10 files] [number of workers]"
     return
 fi
 
 dir_path=/data/bond/licq/datasets/JetClassII/$1
-mkdir -p ${dir_path}_merged
+target_mb=${2:-0}
+workers=${3:-8}
+merger_path=$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)/../delphes_ana_el9/mergeNtuples.C
 
-# Counter
-count=0
-index=0
-A=""
-
-# Find all files, sort them, and iterate
-find "$dir_path" -type f | sort | while IFS= read -r file; do
-    A+="$file "
-
-    # Increment the counter
-    ((count++))
-
-    # Every 10 files, print a newline
-    if ((count % 10 == 0)); then
-        hadd ${dir_path}_merged/ntuples_$index.root $A
-        ((index++))
-        A=""
-    fi
-done
-hadd ${dir_path}_merged/ntuples_$index.root $A
+# Merge the groups in parallel with TFileMerger (no recompression when the inputs share their compression settings);
+# all the .root files below the dataset directory are merged; rerunning the same command resumes an interrupted merge
+root -b -q $merger_path'+("'$dir_path'", "'${dir_path}_merged'", "ntuples", '$target_mb', 10, '$workers')'